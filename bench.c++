@@ -0,0 +1,451 @@
+// Times the JSON generator over a CodeGeneratorRequest twice: once through
+// BaseGenerator's virtual hooks (CapnpcJson) and once through the
+// StaticGenerator flavour (StaticCapnpcJson), and breaks each iteration down
+// into the phases of CapnpcGenericMain: reading the message, loading the
+// nodes, traversing and writing the output. Outputs are written just as the
+// plugin would write them, into the current directory.
+//
+// The request is either a real one, dumped with
+//   capnp compile -o /bin/cat foo.capnp > request.bin
+// or, without a <request> argument, a synthetic one whose shape is set with
+// --files, --structs, --fields, --depth, --annotation-density,
+// --const-size and --const-depth.
+#include <fcntl.h>
+#include <stdlib.h>
+#include "json.h"
+
+// Builds a CodeGeneratorRequest without the schema compiler. Every file gets
+// an annotation declaration, `structs` top-level structs each with a chain of
+// `depth` nested structs, and, when constSize is set, a List(UInt32) and a
+// List(S0) constant of constSize elements. Every struct has `fields` fields,
+// alternating UInt32 and Text. Structs and fields are annotated such that
+// annotationDensity of them (0 to 1) carry the file's annotation. With
+// constDepth set, a `Link` struct pointing to another Link and a List(Link)
+// constant of constSize chains, each constDepth links long, are added too.
+class SyntheticRequest {
+ public:
+  unsigned files = 4;
+  unsigned structs = 50;
+  unsigned fields = 10;
+  unsigned depth = 2;
+  double annotationDensity = 0.25;
+  unsigned constSize = 1000;
+  unsigned constDepth = 0;
+
+  void build(MallocMessageBuilder& message) {
+    auto request = message.initRoot<schema::CodeGeneratorRequest>();
+    unsigned constants = constSize > 0 ? (structs > 0 ? 2 : 1) : 0;
+    unsigned chains = constSize > 0 && constDepth > 0 ? 2 : 0;
+    unsigned nodesPerFile = 2 + structs * (depth + 1) + constants + chains;
+    auto nodes = request.initNodes(files * nodesPerFile);
+    auto requestedFiles = request.initRequestedFiles(files);
+    nextNode_ = 0;
+    nextId_ = 0xa000000000000000ull;
+    annotationCredit_ = 0;
+
+    for (unsigned f = 0; f < files; ++f) {
+      auto filename = kj::str("synthetic", f, ".capnp");
+      auto file = nodes[nextNode_++];
+      uint64_t fileId = nextId_++;
+      file.setId(fileId);
+      file.setDisplayName(filename);
+      file.setFile();
+      auto requestedFile = requestedFiles[f];
+      requestedFile.setId(fileId);
+      requestedFile.setFilename(filename);
+
+      auto nested = file.initNestedNodes(1 + structs + constants + chains);
+      auto annotation = nodes[nextNode_++];
+      tagId_ = nextId_++;
+      init_decl(annotation, nested[0], tagId_, fileId, filename, "tag");
+      auto annotationProto = annotation.initAnnotation();
+      annotationProto.initType().setUint32();
+      annotationProto.setTargetsStruct(true);
+      annotationProto.setTargetsField(true);
+
+      unsigned firstStruct = nextNode_;
+      for (unsigned s = 0; s < structs; ++s) {
+        build_struct(nodes, nested[1 + s], fileId,
+                     kj::str(filename, ':'), kj::str('S', s), depth);
+      }
+      if (constants > 0) {
+        build_constants(nodes, nested, 1 + structs, fileId, filename,
+                        nodes[firstStruct].asReader());
+      }
+      if (chains > 0) {
+        build_chains(nodes, nested, 1 + structs + constants, fileId,
+                     filename);
+      }
+    }
+  }
+
+ private:
+  unsigned nextNode_;
+  uint64_t nextId_;
+  uint64_t tagId_;
+  double annotationCredit_;
+  // Lets build_constants fill in struct values for the synthetic structs.
+  SchemaLoader structLoader_;
+
+  typedef schema::Node::NestedNode NestedNode;
+
+  void init_decl(schema::Node::Builder node, NestedNode::Builder nested,
+                 uint64_t id, uint64_t scopeId, kj::StringPtr prefix,
+                 kj::StringPtr name) {
+    auto displayName = kj::str(prefix, name);
+    node.setId(id);
+    node.setScopeId(scopeId);
+    node.setDisplayName(displayName);
+    node.setDisplayNamePrefixLength(prefix.size());
+    nested.setId(id);
+    nested.setName(name);
+  }
+
+  // Spreads the annotations evenly instead of randomly, so that the same
+  // shape always makes the same request.
+  template <typename Builder>
+  void maybe_annotate(Builder builder, uint32_t value) {
+    annotationCredit_ += annotationDensity;
+    if (annotationCredit_ < 1) {
+      return;
+    }
+    annotationCredit_ -= 1;
+    auto annotation = builder.initAnnotations(1)[0];
+    annotation.setId(tagId_);
+    annotation.initValue().setUint32(value);
+  }
+
+  void build_struct(List<schema::Node>::Builder nodes,
+                    NestedNode::Builder nested, uint64_t scopeId,
+                    kj::StringPtr prefix, kj::StringPtr name,
+                    unsigned nestingLeft) {
+    auto node = nodes[nextNode_++];
+    uint64_t id = nextId_++;
+    init_decl(node, nested, id, scopeId, prefix, name);
+    maybe_annotate(node, id);
+
+    unsigned dataFields = (fields + 1) / 2;
+    unsigned textFields = fields / 2;
+    auto structProto = node.initStruct();
+    structProto.setDataWordCount((dataFields + 1) / 2);
+    structProto.setPointerCount(textFields);
+    structProto.setPreferredListEncoding(schema::ElementSize::INLINE_COMPOSITE);
+    auto fieldList = structProto.initFields(fields);
+    for (unsigned i = 0; i < fields; ++i) {
+      auto field = fieldList[i];
+      auto fieldName = kj::str("field", i);
+      field.setName(fieldName);
+      field.setCodeOrder(i);
+      field.setDiscriminantValue(schema::Field::NO_DISCRIMINANT);
+      field.initOrdinal().setExplicit(i);
+      auto slot = field.initSlot();
+      slot.setOffset(i / 2);
+      if (i % 2 == 0) {
+        slot.initType().setUint32();
+        slot.initDefaultValue().setUint32(0);
+      } else {
+        slot.initType().setText();
+        slot.initDefaultValue().setText("");
+      }
+      maybe_annotate(field, i);
+    }
+
+    if (nestingLeft > 0) {
+      auto nestedPrefix = kj::str(prefix, name, '.');
+      build_struct(nodes, node.initNestedNodes(1)[0], id, nestedPrefix,
+                   "Nested", nestingLeft - 1);
+    }
+  }
+
+  void build_constants(List<schema::Node>::Builder nodes,
+                       List<NestedNode>::Builder nested, unsigned first,
+                       uint64_t fileId, kj::StringPtr filename,
+                       schema::Node::Reader firstStruct) {
+    auto prefix = kj::str(filename, ':');
+    auto values = nodes[nextNode_++];
+    init_decl(values, nested[first], nextId_++, fileId, prefix, "values");
+    auto valuesProto = values.initConst();
+    valuesProto.initType().initList().initElementType().setUint32();
+    auto valueList =
+        valuesProto.initValue().initList().initAs<List<uint32_t>>(constSize);
+    for (unsigned i = 0; i < constSize; ++i) {
+      valueList.set(i, i);
+    }
+    if (structs == 0) {
+      return;
+    }
+
+    // Only has primitive and Text fields, so it loads on its own and gives a
+    // schema to build the values against.
+    auto structSchema = structLoader_.load(firstStruct).asStruct();
+
+    auto records = nodes[nextNode_++];
+    init_decl(records, nested[first + 1], nextId_++, fileId, prefix, "records");
+    auto recordsProto = records.initConst();
+    recordsProto.initType().initList().initElementType().initStruct()
+        .setTypeId(firstStruct.getId());
+    auto recordList = recordsProto.initValue().initList().initAs<DynamicList>(
+        ListSchema::of(structSchema), constSize);
+    for (unsigned i = 0; i < constSize; ++i) {
+      auto record = recordList[i].as<DynamicStruct>();
+      for (auto field : structSchema.getFields()) {
+        if (field.getType().isText()) {
+          record.set(field, Text::Reader("record"));
+        } else {
+          record.set(field, i);
+        }
+      }
+    }
+  }
+
+  // struct Link { value @0 :UInt32; label @1 :Text; next @2 :Link; }
+  // const chains :List(Link), every element constDepth links deep.
+  void build_chains(List<schema::Node>::Builder nodes,
+                    List<NestedNode>::Builder nested, unsigned first,
+                    uint64_t fileId, kj::StringPtr filename) {
+    auto prefix = kj::str(filename, ':');
+    auto link = nodes[nextNode_++];
+    uint64_t linkId = nextId_++;
+    init_decl(link, nested[first], linkId, fileId, prefix, "Link");
+    auto linkProto = link.initStruct();
+    linkProto.setDataWordCount(1);
+    linkProto.setPointerCount(2);
+    linkProto.setPreferredListEncoding(schema::ElementSize::INLINE_COMPOSITE);
+    auto linkFields = linkProto.initFields(3);
+    const char* names[] = {"value", "label", "next"};
+    for (unsigned i = 0; i < 3; ++i) {
+      auto field = linkFields[i];
+      field.setName(names[i]);
+      field.setCodeOrder(i);
+      field.setDiscriminantValue(schema::Field::NO_DISCRIMINANT);
+      field.initOrdinal().setExplicit(i);
+      auto slot = field.initSlot();
+      slot.setOffset(i == 0 ? 0 : i - 1);
+      switch (i) {
+        case 0:
+          slot.initType().setUint32();
+          slot.initDefaultValue().setUint32(0);
+          break;
+        case 1:
+          slot.initType().setText();
+          slot.initDefaultValue().setText("");
+          break;
+        case 2:
+          slot.initType().initStruct().setTypeId(linkId);
+          slot.initDefaultValue().initStruct();
+          break;
+      }
+    }
+    auto linkSchema = structLoader_.load(link.asReader()).asStruct();
+    auto valueField = linkSchema.getFieldByName("value");
+    auto labelField = linkSchema.getFieldByName("label");
+    auto nextField = linkSchema.getFieldByName("next");
+
+    auto chains = nodes[nextNode_++];
+    init_decl(chains, nested[first + 1], nextId_++, fileId, prefix, "chains");
+    auto chainsProto = chains.initConst();
+    chainsProto.initType().initList().initElementType().initStruct()
+        .setTypeId(linkId);
+    auto chainList = chainsProto.initValue().initList().initAs<DynamicList>(
+        ListSchema::of(linkSchema), constSize);
+    for (unsigned i = 0; i < constSize; ++i) {
+      auto current = chainList[i].as<DynamicStruct>();
+      for (unsigned d = 0; d < constDepth; ++d) {
+        current.set(valueField, d);
+        current.set(labelField, Text::Reader("link"));
+        if (d + 1 < constDepth) {
+          current = current.init(nextField).as<DynamicStruct>();
+        }
+      }
+    }
+  }
+};
+
+class CapnpcGenericBench {
+ public:
+  CapnpcGenericBench(kj::ProcessContext& context): context(context) {}
+
+  kj::MainFunc getMain() {
+    kj::MainBuilder builder(
+        context, "Generator benchmark",
+        "Traverses <request>, or a synthetic request, with the virtual and "
+        "the static JSON generator and reports the time per iteration of "
+        "each phase.");
+    CapnpcJson::add_options(builder, jsonOptions);
+    return builder
+        .addOptionWithArg({'n', "iterations"}, KJ_BIND_METHOD(*this, setIterations),
+                          "<count>", "Traverse the request <count> times per generator.")
+        .addOptionWithArg({"files"}, count(synthetic.files), "<n>",
+                          "Synthetic request: number of files.")
+        .addOptionWithArg({"structs"}, count(synthetic.structs), "<n>",
+                          "Synthetic request: top-level structs per file.")
+        .addOptionWithArg({"fields"}, count(synthetic.fields), "<n>",
+                          "Synthetic request: fields per struct.")
+        .addOptionWithArg({"depth"}, count(synthetic.depth), "<n>",
+                          "Synthetic request: structs nested in each "
+                          "top-level struct, one inside the other.")
+        .addOptionWithArg({"annotation-density"},
+                          KJ_BIND_METHOD(*this, setAnnotationDensity),
+                          "<fraction>", "Synthetic request: fraction of "
+                          "structs and fields that are annotated.")
+        .addOptionWithArg({"const-size"}, count(synthetic.constSize), "<n>",
+                          "Synthetic request: elements in each list constant.")
+        .addOptionWithArg({"const-depth"}, count(synthetic.constDepth), "<n>",
+                          "Synthetic request: also add a constant of "
+                          "--const-size struct chains, each <n> structs "
+                          "deep. Readers stop at 64 levels of nesting.")
+        .addOptionWithArg({"save"}, KJ_BIND_METHOD(*this, setSavePath), "<path>",
+                          "Also write the request to <path>, e.g. to run a "
+                          "plugin on it with --request-file.")
+        .expectOptionalArg("<request>", KJ_BIND_METHOD(*this, setRequest))
+        .callAfterParsing(KJ_BIND_METHOD(*this, run))
+        .build();
+  }
+
+ private:
+  kj::ProcessContext& context;
+  JsonOptions jsonOptions;
+  SyntheticRequest synthetic;
+  unsigned long iterations = 10;
+  kj::String requestPath;
+  kj::String savePath;
+
+  // Milliseconds per iteration of each phase of CapnpcGenericMain::run.
+  struct Phases {
+    double read = 0;
+    double load = 0;
+    double traverse = 0;
+    double write = 0;
+    double total() const { return read + load + traverse + write; }
+  };
+
+  static kj::Function<kj::MainBuilder::Validity(kj::StringPtr)> count(
+      unsigned& target) {
+    return [&target](kj::StringPtr arg) -> kj::MainBuilder::Validity {
+      char* end;
+      target = strtoul(arg.cStr(), &end, 10);
+      if (*end != '\0') {
+        return "expected a number";
+      }
+      return true;
+    };
+  }
+
+  kj::MainBuilder::Validity setIterations(kj::StringPtr arg) {
+    char* end;
+    iterations = strtoul(arg.cStr(), &end, 10);
+    if (*end != '\0' || iterations == 0) {
+      return "expected a positive integer";
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity setAnnotationDensity(kj::StringPtr arg) {
+    char* end;
+    synthetic.annotationDensity = strtod(arg.cStr(), &end);
+    if (*end != '\0' || synthetic.annotationDensity < 0 ||
+        synthetic.annotationDensity > 1) {
+      return "expected a fraction between 0 and 1";
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity setSavePath(kj::StringPtr arg) {
+    savePath = kj::heapString(arg);
+    return true;
+  }
+
+  kj::MainBuilder::Validity setRequest(kj::StringPtr arg) {
+    requestPath = kj::heapString(arg);
+    return true;
+  }
+
+  // Goes through the same steps as CapnpcGenericMain, from the serialized
+  // request to the written outputs, with a fresh loader every iteration.
+  template <class Generator>
+  Phases time_generator(kj::ArrayPtr<const word> message) {
+    Phases phases;
+    for (unsigned long i = 0; i < iterations; ++i) {
+      Stopwatch stopwatch;
+      kj::ArrayInputStream input(message.asBytes());
+      ReaderOptions options;
+      options.traversalLimitInWords = Generator::TRAVERSAL_LIMIT;
+      InputStreamMessageReader reader(input, options);
+      const auto& request = reader.getRoot<schema::CodeGeneratorRequest>();
+      double readMs = stopwatch.elapsed_ms();
+
+      SchemaLoader schemaLoader;
+      for (const auto& node: request.getNodes()) {
+        schemaLoader.load(node);
+      }
+      SchemaIndex schemaIndex(schemaLoader, request.getRequestedFiles());
+      double loadMs = stopwatch.elapsed_ms() - readMs;
+
+      Generator generator(schemaLoader, jsonOptions);
+      generator.schemaIndex = &schemaIndex;
+      for (const auto& requestedFile: request.getRequestedFiles()) {
+        const auto& schema = schemaLoader.get(requestedFile.getId());
+        generator.traverse_file(schema, requestedFile);
+      }
+      generator.finish();
+      generator.flush_outputs();
+      double generateMs = stopwatch.elapsed_ms() - readMs - loadMs;
+
+      phases.read += readMs;
+      phases.load += loadMs;
+      phases.write += generator.output_stats().ms;
+      phases.traverse += generateMs - generator.output_stats().ms;
+    }
+    phases.read /= iterations;
+    phases.load /= iterations;
+    phases.traverse /= iterations;
+    phases.write /= iterations;
+    return phases;
+  }
+
+  void print_phases(const char* name, const Phases& phases) {
+    printf("%-27s %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, phases.read,
+           phases.load, phases.traverse, phases.write, phases.total());
+  }
+
+  kj::MainBuilder::Validity run() {
+    MallocMessageBuilder message;
+    if (requestPath != nullptr) {
+      int fd = open(requestPath.cStr(), O_RDONLY);
+      if (fd < 0) {
+        return kj::str("could not open ", requestPath);
+      }
+      auto _ = Finally([&](){close(fd);});
+      ReaderOptions options;
+      options.traversalLimitInWords = CapnpcJson::TRAVERSAL_LIMIT;
+      StreamFdMessageReader reader(fd, options);
+      message.setRoot(reader.getRoot<schema::CodeGeneratorRequest>());
+    } else {
+      synthetic.build(message);
+    }
+    auto words = messageToFlatArray(message);
+    if (savePath != nullptr) {
+      int fd = open(savePath.cStr(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      if (fd < 0) {
+        return kj::str("could not open ", savePath);
+      }
+      auto _ = Finally([&](){close(fd);});
+      writeMessageToFd(fd, message);
+    }
+
+    // Warm up the caches and the output files before measuring.
+    time_generator<StaticCapnpcJson>(words);
+    Phases virtualPhases = time_generator<CapnpcJson>(words);
+    Phases staticPhases = time_generator<StaticCapnpcJson>(words);
+    printf("%-27s %10s %10s %10s %10s %10s\n", "ms/iteration", "read", "load",
+           "traverse", "write", "total");
+    print_phases("virtual (BaseGenerator)", virtualPhases);
+    print_phases("static  (StaticGenerator)", staticPhases);
+    printf("traversal speedup:          %10.2fx\n",
+           virtualPhases.traverse / staticPhases.traverse);
+    fflush(stdout);
+    return true;
+  }
+};
+
+KJ_MAIN(CapnpcGenericBench);
@@ -0,0 +1,149 @@
+// Plugin shim for a generator running with --server. Use it in place of the
+// generator:
+//
+//   export CAPNPC_GENERIC_SOCKET=/tmp/json.sock CAPNPC_GENERIC_FALLBACK=./json
+//   capnp compile -o ./client foo.capnp
+//
+// It forwards the request on stdin, along with the directory capnp ran it in,
+// to the server listening on $CAPNPC_GENERIC_SOCKET and exits with the
+// server's status. When no server is listening it runs
+// $CAPNPC_GENERIC_FALLBACK, the generator itself, on the untouched request
+// instead. See CapnpcGenericMain::serve for the framing.
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static int connect_to(const char* path) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&address),
+              sizeof(address)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool write_all(int fd, const void* data, size_t size) {
+  const char* pos = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, pos, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    pos += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+  char* pos = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = read(fd, pos, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    pos += n;
+    size -= n;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const char* socketPath = getenv("CAPNPC_GENERIC_SOCKET");
+  const char* fallback = getenv("CAPNPC_GENERIC_FALLBACK");
+  int server = socketPath != nullptr ? connect_to(socketPath) : -1;
+  if (server < 0) {
+    if (fallback != nullptr) {
+      argv[0] = const_cast<char*>(fallback);
+      execv(fallback, argv);
+      fprintf(stderr, "could not run %s: %s\n", fallback, strerror(errno));
+    } else {
+      fprintf(stderr, "no generator server at $CAPNPC_GENERIC_SOCKET and no "
+              "$CAPNPC_GENERIC_FALLBACK to run instead\n");
+    }
+    return 1;
+  }
+
+  // A server that rejects the request closes the connection without reading
+  // the rest of it. Sending then fails instead of killing the shim, and the
+  // server's response still says why.
+  signal(SIGPIPE, SIG_IGN);
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+    perror("getcwd");
+    return 1;
+  }
+  uint32_t cwdSize = strlen(cwd);
+  int sendError = 0;
+  if (!write_all(server, &cwdSize, sizeof(cwdSize)) ||
+      !write_all(server, cwd, cwdSize)) {
+    sendError = errno;
+  }
+  // The server knows from the message's segment table where it ends, so the
+  // request is passed through as is.
+  char buffer[1 << 16];
+  while (sendError == 0) {
+    ssize_t n = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      perror("reading the request");
+      return 1;
+    }
+    if (n == 0) {
+      break;
+    }
+    if (!write_all(server, buffer, n)) {
+      sendError = errno;
+    }
+  }
+
+  uint32_t response[2];
+  if (!read_all(server, response, sizeof(response))) {
+    if (sendError != 0) {
+      fprintf(stderr, "sending the request: %s\n", strerror(sendError));
+    } else {
+      fprintf(stderr, "the generator server closed the connection\n");
+    }
+    return 1;
+  }
+  while (response[1] > 0) {
+    size_t chunk = response[1] < sizeof(buffer) ? response[1] : sizeof(buffer);
+    if (!read_all(server, buffer, chunk)) {
+      break;
+    }
+    fwrite(buffer, 1, chunk, stderr);
+    response[1] -= chunk;
+  }
+  if (response[0] != 0) {
+    fputc('\n', stderr);
+  }
+  close(server);
+  return response[0] == 0 ? 0 : 1;
+}
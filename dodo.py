@@ -30,7 +30,7 @@ visit_methods = collections.OrderedDict([
                             'schema::Field::Group::Reader', 'Schema']),
     ('struct_field_union', ['StructSchema']),
     ('interface_decl', ['Schema', 'schema::Node::NestedNode::Reader']),
-    ('param_list', ['InterfaceSchema', 'kj::String', 'StructSchema']),
+    ('param_list', ['InterfaceSchema', 'kj::StringPtr', 'StructSchema']),
     ('method', ['InterfaceSchema', 'InterfaceSchema::Method']),
     ('methods', ['InterfaceSchema']),
     ('method_implicit_params', [
@@ -40,6 +40,54 @@ visit_methods = collections.OrderedDict([
     ('enumerants', ['Schema', 'EnumSchema::EnumerantList']),
 ])
 
+# The overridable traverse_* methods of BaseGenerator, in the order the
+# traversal defines them. A list and not a dict since some are overloaded.
+traverse_methods = [
+    ('file', ['Schema', 'RequestedFile']),
+    ('imports', ['Schema', 'List<Import>::Reader']),
+    ('nested_decls', ['Schema']),
+    ('decl', ['Schema', 'NestedNode']),
+    ('struct_decl', ['Schema', 'NestedNode']),
+    ('enum_decl', ['Schema', 'NestedNode']),
+    ('const_decl', ['Schema', 'NestedNode']),
+    ('annotation_decl', ['Schema', 'NestedNode']),
+    ('annotations', ['Schema']),
+    ('annotations', ['Schema', 'List<schema::Annotation>::Reader']),
+    ('annotation', ['schema::Annotation::Reader', 'Schema']),
+    ('type', ['Schema', 'schema::Type::Reader']),
+    ('dynamic_value', ['Schema', 'Type', 'DynamicValue::Reader']),
+    ('value', ['Schema', 'Type', 'schema::Value::Reader']),
+    ('struct_fields', ['StructSchema']),
+    ('struct_field', ['StructSchema', 'StructSchema::Field']),
+    ('interface_decl', ['Schema', 'NestedNode']),
+    ('method', ['Schema', 'InterfaceSchema::Method']),
+    ('param_list', ['InterfaceSchema', 'kj::StringPtr', 'StructSchema']),
+    ('enumerants', ['Schema', 'EnumSchema::EnumerantList']),
+]
+
+# The value types with typed hooks, as (schema::Type enumerant, type for
+# DynamicValue::Reader::as<>(), hook parameter type). Each gets a
+# visit_<name>_value() hook, and each primitive one a visit_<name>_list() hook
+# for a List of it; both are tried, once, before the DynamicValue hooks. One
+# name per type, so defining one never hides the others.
+primitive_types = [
+    ('bool', 'bool', 'bool'),
+    ('int8', 'int8_t', 'int8_t'),
+    ('int16', 'int16_t', 'int16_t'),
+    ('int32', 'int32_t', 'int32_t'),
+    ('int64', 'int64_t', 'int64_t'),
+    ('uint8', 'uint8_t', 'uint8_t'),
+    ('uint16', 'uint16_t', 'uint16_t'),
+    ('uint32', 'uint32_t', 'uint32_t'),
+    ('uint64', 'uint64_t', 'uint64_t'),
+    ('float32', 'float', 'float'),
+    ('float64', 'double', 'double'),
+]
+scalar_types = primitive_types + [
+    ('text', 'Text', 'Text::Reader'),
+    ('data', 'Data', 'Data::Reader'),
+]
+
 python_keywords = [
     'and', 'as', 'assert', 'break', 'class', 'continue', 'def', 'del', 'elif',
     'else', 'except', 'exec', 'finally', 'for', 'from', 'global', 'if',
@@ -54,9 +102,12 @@ class Cog(object):
     globals = {
         'smaller_annotations': True,
         'visit_methods': visit_methods,
+        'traverse_methods': traverse_methods,
+        'primitive_types': primitive_types,
+        'scalar_types': scalar_types,
         'python_keywords': python_keywords,
     }
-    filenames = ['json.c++', 'generic.h']
+    filenames = ['json.h', 'generic.h']
 
     @classmethod
     def create_doit_tasks(cls):
@@ -87,12 +138,12 @@ class Compile(object):
             str(p) for p in pathlib.Path(dir).glob('**') if p.is_file())
 
     capnp_location = '../../github_capnproto/c++/build'
-    clang_flags = '-std=c++14 -fpermissive -Wall'
+    clang_flags = '-std=c++14 -fpermissive -Wall -pthread'
     rapidjson_flags = '-Irapidjson/include'
     deathhandler_flags = ('-g -rdynamic -IDeathHandler -DUSE_DEATH_HANDLER=1 '
                           'DeathHandler/death_handler.cc -ldl')
-    cc_files = ['json.c++']
-    header_file = 'generic.h'
+    cc_files = ['json.c++', 'bench.c++', 'client.c++']
+    header_files = ['generic.h', 'json.h']
 
     @classmethod
     def create_doit_tasks(cls):
@@ -107,21 +158,56 @@ class Compile(object):
             ['%s/lib/libcapnp.a' % cls.capnp_location,
              '%s/lib/libkj.a' % cls.capnp_location])
         file_deps.extend(cls.recurse_dir('DeathHandler'))
-        file_deps.append(cls.header_file)
+        file_deps.extend(cls.header_files)
 
         for cc_file in cls.cc_files:
             compile_json = ('clang++ %s %s %s %s %s -o %%(targets)s' % (
                 cc_file, cls.clang_flags, cls.rapidjson_flags,
                 cls.deathhandler_flags, capnp_flags))
             base_name = os.path.splitext(cc_file)[0]
-            file_deps = file_deps + [cc_file]
             yield {'actions': [compile_json],
-                   'targets': [base_name], 'file_dep': file_deps,
-                   'task_dep': ['cog_%s' % cc_file,
-                                'cog_%s' % os.path.basename(cls.header_file)],
+                   'targets': [base_name], 'file_dep': file_deps + [cc_file],
+                   'task_dep': ['cog_%s' % os.path.basename(filename)
+                                for filename in Cog.filenames],
                    'basename': 'compile_%s' % cc_file}
 
 
+class Bench(object):
+    """Runs the bench binary over synthetic requests of a few shapes.
+
+    Run it with `doit bench` before and after a change to generic.h or json.h
+    and compare the per-phase numbers. The JSON outputs go to bench_output/.
+    """
+    iterations = 10
+    shapes = collections.OrderedDict([
+        ('wide', '--files=8 --structs=200 --fields=20 --depth=0'),
+        ('deep', '--files=2 --structs=20 --fields=5 --depth=32'),
+        ('annotated', '--files=4 --structs=50 --fields=10 '
+                      '--annotation-density=1'),
+        ('constants', '--files=2 --structs=5 --const-size=100000'),
+        ('nested-constants', '--files=2 --structs=5 --const-size=2000 '
+                             '--const-depth=48'),
+    ])
+    output_dir = 'bench_output'
+
+    @classmethod
+    def create_doit_tasks(cls):
+        for name, flags in cls.shapes.items():
+            yield {
+                'actions': [
+                    'mkdir -p %s' % cls.output_dir,
+                    'echo "%s: %s"' % (name, flags),
+                    'cd %s && ../bench --iterations=%d %s' % (
+                        cls.output_dir, cls.iterations, flags),
+                ],
+                'task_dep': ['compile_bench.c++'],
+                'uptodate': [False],
+                'verbosity': 2,
+                'basename': 'bench',
+                'name': name,
+            }
+
+
 # From:
 # https://github.com/shazow/unstdlib.py/blob/e2cf942330630381aee6a843fd1d379fe98d1edb/unstdlib/standard/list_.py#L149
 def listify(fn=None, wrapper=list):
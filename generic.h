@@ -1,9 +1,26 @@
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <initializer_list>
+#include <mutex>
 #include <typeinfo>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <kj/main.h>
 #include <kj/string.h>
+#include <capnp/any.h>
 #include <capnp/dynamic.h>
 #include <capnp/message.h>
 #include <capnp/serialize.h>
@@ -14,9 +31,17 @@
 using namespace capnp;
 
 #define GUARD_FALSE(result) if(result) return true
-#define PRE_VISIT(type, ...) GUARD_FALSE(pre_visit_##type(__VA_ARGS__))
-#define POST_VISIT(type, ...) GUARD_FALSE(post_visit_##type(__VA_ARGS__))
-#define TRAVERSE(type, ...) traverse_##type(__VA_ARGS__)
+#define PRE_VISIT(type, ...) GUARD_FALSE(this->self().pre_visit_##type(__VA_ARGS__))
+#define POST_VISIT(type, ...) GUARD_FALSE(this->self().post_visit_##type(__VA_ARGS__))
+// Every nested traverse call is bracketed by enter_traverse() and
+// leave_traverse(); use TRAVERSE_GUARDED where the caller returns on a true
+// result with GUARD_FALSE.
+#define TRAVERSE(type, ...) \
+  (this->self().traverse_frame(false), \
+   this->self().traverse_##type(__VA_ARGS__))
+#define TRAVERSE_GUARDED(type, ...) \
+  (this->self().traverse_frame(true), \
+   this->self().traverse_##type(__VA_ARGS__))
 
 // Use this to do something when the scope exits.
 template<typename F>
@@ -32,478 +57,4762 @@ FinallyImpl<F> Finally(F f) {
   return FinallyImpl<F>(f);
 }
 
-class BaseGenerator {
-  public:
-   BaseGenerator(SchemaLoader& schemaLoader)
-       : schemaLoader(schemaLoader) {}
-  SchemaLoader &schemaLoader;
+// Wall time since construction, for the --stats output and benchmarks.
+class Stopwatch {
+ public:
+  Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+  double elapsed_ms() const {
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    return elapsed.count();
+  }
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
 
-  const static auto TRAVERSAL_LIMIT = 1 << 30;  // Don't limit.
-  constexpr static const char *TITLE = "Generator title";
-  constexpr static const char *DESCRIPTION = "Generator description";
+// Memoizes SchemaLoader::get(id, brand, scope) for one generator. Unbranded
+// lookups, by far the most common, don't depend on the scope and are keyed by
+// id alone; branded ones are keyed by id, scope and the brand's contents.
+// Not thread-safe, every generator has its own.
+class SchemaResolver {
+ public:
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    Stats& operator+=(const Stats& other) {
+      hits += other.hits;
+      misses += other.misses;
+      return *this;
+    }
+  };
 
-  typedef schema::CodeGeneratorRequest::RequestedFile::Reader RequestedFile;
-  virtual bool traverse_file(
-      const Schema& file, const RequestedFile& requestedFile) {
-    PRE_VISIT(file, file, requestedFile);
-    TRAVERSE(imports, file, requestedFile.getImports());
-    const auto& proto = file.getProto();
-    TRAVERSE(nested_decls, file);
-    TRAVERSE(annotations, file, proto.getAnnotations());
-    POST_VISIT(file, file, requestedFile);
-    return false;
+  SchemaResolver(SchemaLoader& schemaLoader) : schemaLoader_(schemaLoader) {}
+
+  Schema get(uint64_t id, const schema::Brand::Reader& brand,
+             const Schema& scope) {
+    if (brand.getScopes().size() == 0) {
+      auto iter = unbranded_.find(id);
+      if (iter != unbranded_.end()) {
+        ++stats_.hits;
+        return iter->second;
+      }
+      ++stats_.misses;
+      auto schema = schemaLoader_.get(id, brand, scope);
+      unbranded_.emplace(id, schema);
+      return schema;
+    }
+    Key key = {id, brand, scope, key_hash(id, brand)};
+    auto iter = branded_.find(key);
+    if (iter != branded_.end()) {
+      ++stats_.hits;
+      return iter->second;
+    }
+    ++stats_.misses;
+    auto schema = schemaLoader_.get(id, brand, scope);
+    branded_.emplace(key, schema);
+    return schema;
   }
 
-  virtual void finish() {}
+  const Stats& stats() const { return stats_; }
 
-  typedef schema::CodeGeneratorRequest::RequestedFile::Import Import;
-  virtual bool traverse_imports(const Schema& schema, const List<Import>::Reader& imports) {
-    PRE_VISIT(imports, schema, imports);
-    for (const auto& import : imports) {
-      PRE_VISIT(import, schema, import);
-      POST_VISIT(import, schema, import);
+ private:
+  struct Key {
+    uint64_t id;
+    schema::Brand::Reader brand;
+    Schema scope;
+    size_t hash;
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const { return key.hash; }
+  };
+  struct KeyEqual {
+    bool operator()(const Key& a, const Key& b) const {
+      return a.hash == b.hash && a.id == b.id && a.scope == b.scope &&
+             same_brand(a.brand, b.brand);
     }
-    POST_VISIT(imports, schema, imports);
-    return false;
+  };
+
+  static size_t mix(size_t hash, uint64_t value) {
+    return (hash ^ value) * 1099511628211ull;
   }
 
-  virtual bool traverse_nested_decls(const Schema& schema) {
-    const auto& proto = schema.getProto();
-    const auto& nodes = proto.getNestedNodes();
-    if (nodes.size() == 0) return false;
-    PRE_VISIT(nested_decls, schema);
-    for (const auto& decl : nodes) {
-      const auto& schema = schemaLoader.getUnbound(decl.getId());
-      const auto& proto = schema.getProto();
-      PRE_VISIT(decl, schema, decl);
-      switch (proto.which()) {
-        case schema::Node::FILE:
-          break;
-        case schema::Node::STRUCT: {
-          TRAVERSE(struct_decl, schema, decl); break;
+  static size_t hash_type(size_t hash, const schema::Type::Reader& type) {
+    hash = mix(hash, type.which());
+    switch (type.which()) {
+      case schema::Type::LIST:
+        return hash_type(hash, type.getList().getElementType());
+      case schema::Type::ENUM:
+        return hash_brand(mix(hash, type.getEnum().getTypeId()),
+                          type.getEnum().getBrand());
+      case schema::Type::STRUCT:
+        return hash_brand(mix(hash, type.getStruct().getTypeId()),
+                          type.getStruct().getBrand());
+      case schema::Type::INTERFACE:
+        return hash_brand(mix(hash, type.getInterface().getTypeId()),
+                          type.getInterface().getBrand());
+      case schema::Type::ANY_POINTER: {
+        auto anyPointer = type.getAnyPointer();
+        hash = mix(hash, anyPointer.which());
+        if (anyPointer.isParameter()) {
+          hash = mix(hash, anyPointer.getParameter().getScopeId());
+          hash = mix(hash, anyPointer.getParameter().getParameterIndex());
+        } else if (anyPointer.isImplicitMethodParameter()) {
+          hash = mix(hash,
+                     anyPointer.getImplicitMethodParameter().getParameterIndex());
         }
-        case schema::Node::ENUM: {
-          TRAVERSE(enum_decl, schema, decl); break;
+        return hash;
+      }
+      default:
+        return hash;
+    }
+  }
+
+  static size_t hash_brand(size_t hash, const schema::Brand::Reader& brand) {
+    for (const auto& scope : brand.getScopes()) {
+      hash = mix(mix(hash, scope.getScopeId()), scope.which());
+      if (scope.isBind()) {
+        for (const auto& binding : scope.getBind()) {
+          hash = binding.isType() ? hash_type(hash, binding.getType())
+                                  : mix(hash, 0);
         }
-        case schema::Node::INTERFACE: {
-          TRAVERSE(interface_decl, schema, decl); break;
+      }
+    }
+    return hash;
+  }
+
+  static bool same_type(const schema::Type::Reader& a,
+                        const schema::Type::Reader& b) {
+    if (a.which() != b.which()) return false;
+    switch (a.which()) {
+      case schema::Type::LIST:
+        return same_type(a.getList().getElementType(),
+                         b.getList().getElementType());
+      case schema::Type::ENUM:
+        return a.getEnum().getTypeId() == b.getEnum().getTypeId() &&
+               same_brand(a.getEnum().getBrand(), b.getEnum().getBrand());
+      case schema::Type::STRUCT:
+        return a.getStruct().getTypeId() == b.getStruct().getTypeId() &&
+               same_brand(a.getStruct().getBrand(), b.getStruct().getBrand());
+      case schema::Type::INTERFACE:
+        return a.getInterface().getTypeId() == b.getInterface().getTypeId() &&
+               same_brand(a.getInterface().getBrand(),
+                          b.getInterface().getBrand());
+      case schema::Type::ANY_POINTER: {
+        auto anyA = a.getAnyPointer();
+        auto anyB = b.getAnyPointer();
+        if (anyA.which() != anyB.which()) return false;
+        if (anyA.isParameter()) {
+          return anyA.getParameter().getScopeId() ==
+                     anyB.getParameter().getScopeId() &&
+                 anyA.getParameter().getParameterIndex() ==
+                     anyB.getParameter().getParameterIndex();
         }
-        case schema::Node::CONST: {
-          TRAVERSE(const_decl, schema, decl); break;
+        if (anyA.isImplicitMethodParameter()) {
+          return anyA.getImplicitMethodParameter().getParameterIndex() ==
+                 anyB.getImplicitMethodParameter().getParameterIndex();
         }
-        case schema::Node::ANNOTATION: {
-          TRAVERSE(annotation_decl, schema, decl); break;
+        return true;
+      }
+      default:
+        return true;
+    }
+  }
+
+  static bool same_brand(const schema::Brand::Reader& a,
+                         const schema::Brand::Reader& b) {
+    auto scopesA = a.getScopes();
+    auto scopesB = b.getScopes();
+    if (scopesA.size() != scopesB.size()) return false;
+    for (uint32_t i = 0; i < scopesA.size(); ++i) {
+      auto scopeA = scopesA[i];
+      auto scopeB = scopesB[i];
+      if (scopeA.getScopeId() != scopeB.getScopeId() ||
+          scopeA.which() != scopeB.which()) {
+        return false;
+      }
+      if (!scopeA.isBind()) continue;
+      auto bindA = scopeA.getBind();
+      auto bindB = scopeB.getBind();
+      if (bindA.size() != bindB.size()) return false;
+      for (uint32_t j = 0; j < bindA.size(); ++j) {
+        if (bindA[j].isType() != bindB[j].isType()) return false;
+        if (bindA[j].isType() &&
+            !same_type(bindA[j].getType(), bindB[j].getType())) {
+          return false;
         }
       }
-      POST_VISIT(decl, schema, decl);
     }
-    POST_VISIT(nested_decls, schema);
-    return false;
+    return true;
   }
 
-  typedef schema::Node::NestedNode::Reader NestedNode;
-  virtual bool traverse_struct_decl(const Schema& schema, const NestedNode& decl) {
-    PRE_VISIT(struct_decl, schema, decl);
-    TRAVERSE(nested_decls, schema);
-    TRAVERSE(struct_fields, schema.asStruct());
-    TRAVERSE(annotations, schema);
-    POST_VISIT(struct_decl, schema, decl);
-    return false;
+  static size_t key_hash(uint64_t id, const schema::Brand::Reader& brand) {
+    return hash_brand(mix(14695981039346656037ull, id), brand);
   }
 
-  virtual bool traverse_enum_decl(const Schema& schema, const NestedNode& decl) {
-    PRE_VISIT(enum_decl, schema, decl);
-    TRAVERSE(nested_decls, schema);
-    TRAVERSE(enumerants, schema, schema.asEnum().getEnumerants());
-    TRAVERSE(annotations, schema);
-    POST_VISIT(enum_decl, schema, decl);
-    return false;
+  SchemaLoader& schemaLoader_;
+  std::unordered_map<uint64_t, Schema> unbranded_;
+  std::unordered_map<Key, Schema, KeyHash, KeyEqual> branded_;
+  Stats stats_;
+};
+
+// A flat index of the requested files' declarations, built once per request
+// and shared, read-only, by every generator. Entries are laid out breadth
+// first so each node's children are one contiguous range: its nested
+// declarations in schema order, then the groups of a struct or the
+// auto-generated param and result structs of an interface's methods.
+class SchemaIndex {
+ public:
+  constexpr static uint32_t NONE = ~0u;
+
+  // Set by select(). Without a selection every entry is UNSELECTED and the
+  // traversal goes everywhere.
+  enum Selection : uint8_t {
+    UNSELECTED,
+    SCOPE,     // Encloses a selected entry; only selected children are walked.
+    SELECTED,  // Walked with everything under it.
+  };
+
+  struct Entry {
+    Schema schema;
+    // Empty for files, groups and param structs, which aren't nested nodes.
+    schema::Node::NestedNode::Reader decl;
+    uint64_t id;
+    schema::Node::Which kind;
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t nestedCount;
+    uint32_t childCount;
+    // Fields of a struct, enumerants of an enum or methods of an interface.
+    uint32_t fieldCount;
+    kj::StringPtr displayName;
+    kj::StringPtr shortName;
+    Selection selection;
+  };
+
+  // A node carrying an annotation, or one of its members when member is not
+  // NONE: the member-th field of a struct, enumerant of an enum or method of
+  // an interface.
+  struct Annotated {
+    uint64_t annotationId;
+    uint32_t entry;
+    uint32_t member;
+  };
+
+  typedef schema::CodeGeneratorRequest::RequestedFile RequestedFile;
+  SchemaIndex(SchemaLoader& schemaLoader,
+              const List<RequestedFile>::Reader& requestedFiles) {
+    for (const auto& requestedFile : requestedFiles) {
+      add(schemaLoader.get(requestedFile.getId()),
+          schema::Node::NestedNode::Reader(), NONE);
+    }
+    // Children are appended while walking, so go by position.
+    for (uint32_t i = 0; i < entries_.size(); ++i) {
+      auto proto = entries_[i].schema.getProto();
+      entries_[i].firstChild = entries_.size();
+      for (const auto& decl : proto.getNestedNodes()) {
+        add(schemaLoader.getUnbound(decl.getId()), decl, i);
+      }
+      entries_[i].nestedCount = entries_.size() - entries_[i].firstChild;
+      switch (proto.which()) {
+        case schema::Node::STRUCT:
+          for (const auto& field : proto.getStruct().getFields()) {
+            if (field.isGroup()) {
+              add(schemaLoader.getUnbound(field.getGroup().getTypeId()),
+                  schema::Node::NestedNode::Reader(), i);
+            }
+          }
+          break;
+        case schema::Node::INTERFACE:
+          for (const auto& method : proto.getInterface().getMethods()) {
+            add_param_struct(schemaLoader, method.getParamStructType(), i);
+            add_param_struct(schemaLoader, method.getResultStructType(), i);
+          }
+          break;
+        default:
+          break;
+      }
+      entries_[i].childCount = entries_.size() - entries_[i].firstChild;
+      add_annotated(i, proto);
+    }
+    std::stable_sort(annotated_.begin(), annotated_.end(),
+                     [](const Annotated& a, const Annotated& b) {
+                       return a.annotationId < b.annotationId;
+                     });
   }
 
-  virtual bool traverse_const_decl(const Schema& schema, const NestedNode& decl) {
-    const auto& proto = schema.getProto();
-    PRE_VISIT(const_decl, schema, decl);
-    TRAVERSE(type, schema, proto.getConst().getType());
-    TRAVERSE(value, schema, proto.getConst().getType(), proto.getConst().getValue());
-    TRAVERSE(annotations, schema);
-    POST_VISIT(const_decl, schema, decl);
-    return false;
+  const Entry* find(uint64_t id) const {
+    auto iter = ids_.find(id);
+    return iter == ids_.end() ? nullptr : &entries_[iter->second];
   }
 
-  virtual bool traverse_annotation_decl(const Schema& schema, const NestedNode& decl ) {
-    PRE_VISIT(annotation_decl, schema, decl);
-    TRAVERSE(type, schema, schema.getProto().getAnnotation().getType());
-    TRAVERSE(annotations, schema);
-    POST_VISIT(annotation_decl, schema, decl);
-    return false;
+  const Entry& operator[](uint32_t index) const { return entries_[index]; }
+  size_t size() const { return entries_.size(); }
+
+  // The enclosing declaration, following the scope chain up to the file.
+  const Entry* parent(const Entry& entry) const {
+    return entry.parent == NONE ? nullptr : &entries_[entry.parent];
   }
 
-  virtual bool traverse_annotations(const Schema& schema) {
-    TRAVERSE(annotations, schema, schema.getProto().getAnnotations());
-    return false;
+  kj::ArrayPtr<const Entry> children(const Entry& entry) const {
+    return kj::arrayPtr(entries_.data() + entry.firstChild, entry.childCount);
   }
 
-  virtual bool traverse_annotations(
-      const Schema& schema, const List<schema::Annotation>::Reader& annotations) {
-    if (annotations.size() == 0) return false;
-    PRE_VISIT(annotations, schema);
-    for (const auto& ann : annotations) {
-      const auto& annSchema = schemaLoader.get(ann.getId(), ann.getBrand(), schema);
-      TRAVERSE(annotation, ann, annSchema);
-    }
-    POST_VISIT(annotations, schema);
-    return false;
+  kj::ArrayPtr<const Entry> nested(const Entry& entry) const {
+    return kj::arrayPtr(entries_.data() + entry.firstChild, entry.nestedCount);
   }
 
-  virtual bool traverse_annotation(const schema::Annotation::Reader& annotation, const Schema& parent) {
-    PRE_VISIT(annotation, annotation, parent);
-    const auto& decl = schemaLoader.get(annotation.getId(), annotation.getBrand(), parent);
-    const auto& annDecl = decl.getProto().getAnnotation();
-    TRAVERSE(value, parent, annDecl.getType(), annotation.getValue());
-    POST_VISIT(annotation, annotation, parent);
-    return false;
+  uint32_t position(const Entry& entry) const {
+    return &entry - entries_.data();
   }
 
-  virtual bool traverse_type(
-      const Schema& schema, const schema::Type::Reader& type) {
-    PRE_VISIT(type, schema, type);
-    if (type.which() == schema::Type::LIST) {
-      TRAVERSE(type, schema, type.getList().getElementType());
-    }
-    POST_VISIT(type, schema, type);
-    return false;
+  // Everything in the requested files carrying the annotation, in index
+  // order.
+  kj::ArrayPtr<const Annotated> annotated(uint64_t annotationId) const {
+    auto range = std::equal_range(
+        annotated_.begin(), annotated_.end(), Annotated{annotationId, 0, 0},
+        [](const Annotated& a, const Annotated& b) {
+          return a.annotationId < b.annotationId;
+        });
+    return kj::arrayPtr(annotated_.data() + (range.first - annotated_.begin()),
+                        range.second - range.first);
   }
 
-  virtual bool traverse_dynamic_value(const Schema& schema, const Type& type, const DynamicValue::Reader& value) {
-    PRE_VISIT(dynamic_value, schema, type, value);
-    switch (type.which()) {
-      case schema::Type::LIST: {
-        const auto& listType = type.asList();
-        for (const auto& element : value.as<DynamicList>()) {
-          TRAVERSE(dynamic_value, schema, listType.getElementType(), element);
-        }
-        break;
+  // Restricts the traversal to the given entries, everything under them and
+  // the scopes enclosing them. Call it at most once, before generating.
+  void select(const std::vector<uint32_t>& matches) {
+    for (uint32_t match : matches) {
+      entries_[match].selection = SELECTED;
+    }
+    for (uint32_t match : matches) {
+      // Under another match everything is walked anyway.
+      bool covered = false;
+      for (uint32_t i = entries_[match].parent; i != NONE && !covered;
+           i = entries_[i].parent) {
+        covered = entries_[i].selection == SELECTED;
       }
-      case schema::Type::STRUCT: {
-        const auto& structValue = value.as<DynamicStruct>();
-        for (const auto& field : type.asStruct().getFields()) {
-          if (structValue.has(field)) {
-            const auto& fieldValue = structValue.get(field);
-            TRAVERSE(dynamic_value, schema, field.getType(), fieldValue);
-          }
-        }
-        break;
+      if (covered) continue;
+      for (uint32_t i = entries_[match].parent;
+           i != NONE && entries_[i].selection == UNSELECTED;
+           i = entries_[i].parent) {
+        entries_[i].selection = SCOPE;
       }
-      default: break;
     }
-    POST_VISIT(dynamic_value, schema, type, value);
-    return false;
   }
 
-  inline bool traverse_value(const Schema& schema, const schema::Type::Reader& type, const schema::Value::Reader& value) {
-    return traverse_value(schema, schemaLoader.getType(type, schema), value);
-  }
+ private:
+  std::vector<Entry> entries_;
+  std::unordered_map<uint64_t, uint32_t> ids_;
+  std::vector<Annotated> annotated_;
 
-  virtual bool traverse_value(const Schema& schema, const Type& type, const schema::Value::Reader& value) {
-    switch (value.which()) {
-      /*[[[cog
-      sizes = [8, 16, 32, 64]
-      types = ['void', 'text', 'data', 'float32', 'float64', 'bool'] + [
-          'int%d' % size for size in sizes] + [
-          'uint%d' % size for size in sizes]
-      for type in types:
-        cog.outl('case schema::Value::%s:' % type.upper())
-        cog.outl('  TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.get%s()));' % type.title())
-        cog.outl('  break;')
-      ]]]*/
-      case schema::Value::VOID:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getVoid()));
-        break;
-      case schema::Value::TEXT:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getText()));
-        break;
-      case schema::Value::DATA:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getData()));
-        break;
-      case schema::Value::FLOAT32:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getFloat32()));
-        break;
-      case schema::Value::FLOAT64:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getFloat64()));
-        break;
-      case schema::Value::BOOL:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getBool()));
-        break;
-      case schema::Value::INT8:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getInt8()));
-        break;
-      case schema::Value::INT16:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getInt16()));
-        break;
-      case schema::Value::INT32:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getInt32()));
-        break;
-      case schema::Value::INT64:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getInt64()));
-        break;
-      case schema::Value::UINT8:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getUint8()));
+  void add(const Schema& schema, const schema::Node::NestedNode::Reader& decl,
+           uint32_t parent) {
+    auto proto = schema.getProto();
+    if (!ids_.emplace(proto.getId(), entries_.size()).second) return;
+    Entry entry;
+    entry.schema = schema;
+    entry.decl = decl;
+    entry.id = proto.getId();
+    entry.kind = proto.which();
+    entry.parent = parent;
+    entry.firstChild = 0;
+    entry.nestedCount = 0;
+    entry.childCount = 0;
+    switch (proto.which()) {
+      case schema::Node::STRUCT:
+        entry.fieldCount = proto.getStruct().getFields().size();
         break;
-      case schema::Value::UINT16:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getUint16()));
+      case schema::Node::ENUM:
+        entry.fieldCount = proto.getEnum().getEnumerants().size();
         break;
-      case schema::Value::UINT32:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getUint32()));
+      case schema::Node::INTERFACE:
+        entry.fieldCount = proto.getInterface().getMethods().size();
         break;
-      case schema::Value::UINT64:
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getUint64()));
+      default:
+        entry.fieldCount = 0;
         break;
-      //[[[end]]]
-      case schema::Value::LIST: {
-        const auto& listValue = value.getList().getAs<DynamicList>(type.asList());
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(listValue));
+    }
+    entry.displayName = proto.getDisplayName();
+    entry.shortName = schema.getShortDisplayName();
+    entry.selection = UNSELECTED;
+    entries_.push_back(entry);
+  }
+
+  void add_annotated(uint32_t entry, const schema::Node::Reader& proto) {
+    for (const auto& annotation : proto.getAnnotations()) {
+      annotated_.push_back({annotation.getId(), entry, NONE});
+    }
+    switch (proto.which()) {
+      case schema::Node::STRUCT:
+        add_annotated_members(entry, proto.getStruct().getFields());
         break;
-      }
-      case schema::Value::ENUM: {
-        const auto& dynamicEnum = DynamicEnum(type.asEnum(), value.getEnum());
-        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(dynamicEnum));
+      case schema::Node::ENUM:
+        add_annotated_members(entry, proto.getEnum().getEnumerants());
         break;
-      }
-      case schema::Value::STRUCT: {
-        TRAVERSE(dynamic_value, schema, type, value.getStruct().getAs<DynamicStruct>(type.asStruct()));
+      case schema::Node::INTERFACE:
+        add_annotated_members(entry, proto.getInterface().getMethods());
         break;
-      }
-      case schema::Value::INTERFACE:
-      case schema::Value::ANY_POINTER:
-        // These cannot be serialized in a schema file.
+      default:
         break;
     }
-    return false;
   }
 
-  virtual bool traverse_struct_fields(
-      const StructSchema& schema) {
-    PRE_VISIT(struct_fields, schema);
-    const auto& unionFields = schema.getUnionFields();
-    if (unionFields.size() > 0) {
-      PRE_VISIT(struct_field_union, schema);
-      for (const auto& field : unionFields) {
-        TRAVERSE(struct_field, schema, field);
+  template <typename Members>
+  void add_annotated_members(uint32_t entry, const Members& members) {
+    uint32_t member = 0;
+    for (const auto& item : members) {
+      for (const auto& annotation : item.getAnnotations()) {
+        annotated_.push_back({annotation.getId(), entry, member});
       }
-      POST_VISIT(struct_field_union, schema);
-    }
-    for (const auto& field : schema.getNonUnionFields()) {
-      TRAVERSE(struct_field, schema, field);
+      member++;
     }
-    POST_VISIT(struct_fields, schema);
-    return false;
   }
 
-  virtual bool traverse_struct_field(
-      const StructSchema& schema, const StructSchema::Field& field) {
-    auto proto = field.getProto();
-    PRE_VISIT(struct_field, schema, field);
-    switch (proto.which()) {
-      case schema::Field::SLOT: {
-        auto slot = proto.getSlot();
-        PRE_VISIT(struct_field_slot, schema, field, slot);
-        TRAVERSE(type, schema, slot.getType());
-        if (slot.getHadExplicitDefault()) {
-          PRE_VISIT(struct_default_value, schema, field);
-          TRAVERSE(value, schema, slot.getType(), slot.getDefaultValue());
-          POST_VISIT(struct_default_value, schema, field);
-        }
-        POST_VISIT(struct_field_slot, schema, field, slot);
-        break;
-      }
-      case schema::Field::GROUP: {
-        auto group = proto.getGroup();
-        auto groupSchema = schemaLoader.getUnbound(group.getTypeId());
-        PRE_VISIT(struct_field_group, schema, field, group, groupSchema);
-        TRAVERSE(annotations, groupSchema);
-        TRAVERSE(struct_fields, groupSchema.asStruct());
-        POST_VISIT(struct_field_group, schema, field, group, groupSchema);
-        break;
-      }
+  // Auto-generated param structs have no scope; named struct types used as
+  // params are declarations of their own and get indexed where they live.
+  void add_param_struct(SchemaLoader& schemaLoader, uint64_t id,
+                        uint32_t parent) {
+    auto schema = schemaLoader.getUnbound(id);
+    if (schema.getProto().getScopeId() == 0) {
+      add(schema, schema::Node::NestedNode::Reader(), parent);
     }
-    TRAVERSE(annotations, schema, proto.getAnnotations());
-    POST_VISIT(struct_field, schema, field);
-    return false;
   }
+};
 
-  virtual bool traverse_interface_decl(const Schema& schema, const NestedNode& decl) {
-    auto interface = schema.asInterface();
-    PRE_VISIT(interface_decl, schema, decl);
-    TRAVERSE(nested_decls, schema);
-    PRE_VISIT(methods, interface);
-    for (const auto& method : interface.getMethods()) {
-      TRAVERSE(method, interface, method);
-    }
-    POST_VISIT(methods, interface);
-    TRAVERSE(annotations, schema);
-    POST_VISIT(interface_decl, schema, decl);
+// One bit per entry of visit_methods, covering both its pre_visit and its
+// post_visit hook, and one for all the typed value hooks. A generator's
+// interest mask says which hooks it actually consumes, and the traversal
+// skips subtrees that can only reach the others.
+typedef uint64_t HookMask;
+enum : HookMask {
+  /*[[[cog
+  for i, method in enumerate(visit_methods):
+    cog.outl('HOOK_%s = 1ull << %d,' % (method.upper(), i))
+  cog.outl('HOOK_TYPED_VALUE = 1ull << %d,' % len(visit_methods))
+  cog.outl('ALL_HOOKS = (1ull << %d) - 1,' % (len(visit_methods) + 1))
+  ]]]*/
+  HOOK_FILE = 1ull << 0,
+  HOOK_IMPORTS = 1ull << 1,
+  HOOK_IMPORT = 1ull << 2,
+  HOOK_NESTED_DECLS = 1ull << 3,
+  HOOK_DECL = 1ull << 4,
+  HOOK_STRUCT_DECL = 1ull << 5,
+  HOOK_ENUM_DECL = 1ull << 6,
+  HOOK_CONST_DECL = 1ull << 7,
+  HOOK_ANNOTATION_DECL = 1ull << 8,
+  HOOK_ANNOTATION = 1ull << 9,
+  HOOK_ANNOTATIONS = 1ull << 10,
+  HOOK_TYPE = 1ull << 11,
+  HOOK_DYNAMIC_VALUE = 1ull << 12,
+  HOOK_STRUCT_FIELDS = 1ull << 13,
+  HOOK_STRUCT_DEFAULT_VALUE = 1ull << 14,
+  HOOK_STRUCT_FIELD = 1ull << 15,
+  HOOK_STRUCT_FIELD_SLOT = 1ull << 16,
+  HOOK_STRUCT_FIELD_GROUP = 1ull << 17,
+  HOOK_STRUCT_FIELD_UNION = 1ull << 18,
+  HOOK_INTERFACE_DECL = 1ull << 19,
+  HOOK_PARAM_LIST = 1ull << 20,
+  HOOK_METHOD = 1ull << 21,
+  HOOK_METHODS = 1ull << 22,
+  HOOK_METHOD_IMPLICIT_PARAMS = 1ull << 23,
+  HOOK_ENUMERANT = 1ull << 24,
+  HOOK_ENUMERANTS = 1ull << 25,
+  HOOK_TYPED_VALUE = 1ull << 26,
+  ALL_HOOKS = (1ull << 27) - 1,
+  //[[[end]]]
+};
+
+// The hooks reachable from each subtree the traversal can prune.
+constexpr HookMask VALUE_HOOKS = HOOK_DYNAMIC_VALUE | HOOK_TYPED_VALUE;
+constexpr HookMask ANNOTATION_HOOKS =
+    HOOK_ANNOTATIONS | HOOK_ANNOTATION | VALUE_HOOKS;
+constexpr HookMask FIELD_HOOKS =
+    HOOK_STRUCT_FIELDS | HOOK_STRUCT_FIELD | HOOK_STRUCT_FIELD_SLOT |
+    HOOK_STRUCT_FIELD_GROUP | HOOK_STRUCT_FIELD_UNION |
+    HOOK_STRUCT_DEFAULT_VALUE | HOOK_TYPE | ANNOTATION_HOOKS;
+constexpr HookMask PARAM_LIST_HOOKS = HOOK_PARAM_LIST | FIELD_HOOKS;
+constexpr HookMask METHOD_HOOKS =
+    HOOK_METHOD | HOOK_METHOD_IMPLICIT_PARAMS | PARAM_LIST_HOOKS |
+    ANNOTATION_HOOKS;
+constexpr HookMask ENUMERANT_HOOKS =
+    HOOK_ENUMERANTS | HOOK_ENUMERANT | ANNOTATION_HOOKS;
+
+// Whether D declares its own pre_visit_<name> or post_visit_<name>.
+#define DEFINES_HOOK(D, name) \
+  (!std::is_same<decltype(&D::pre_visit_##name), \
+                 decltype(&StaticGenerator::pre_visit_##name)>::value || \
+   !std::is_same<decltype(&D::post_visit_##name), \
+                 decltype(&StaticGenerator::post_visit_##name)>::value)
+// Whether D declares its own visit_<type>_value or visit_<type>_list.
+#define DEFINES_TYPED_HOOK(D, hook) \
+  (!std::is_same<decltype(&D::hook), \
+                 decltype(&StaticGenerator::hook)>::value)
+// Whether D declares its own traverse_<name> taking the given parameters.
+#define OVERRIDES_TRAVERSE(D, name, ...) \
+  (!std::is_same< \
+       decltype(DeclaringClass<__VA_ARGS__>::of(&D::traverse_##name)), \
+       StaticGenerator>::value)
+
+// Whether the <prefix>_visit_param_list D declares only takes the name as a
+// kj::String, the deprecated signature.
+#define LEGACY_PARAM_LIST(D, prefix) \
+  std::is_void<decltype(DeclaringClass< \
+      const InterfaceSchema&, const kj::StringPtr&, const StructSchema&>::of( \
+      &D::prefix##_visit_param_list))>()
+
+// The class declaring the bool method taking Params, picked out of its
+// overloads; void when the name found is only declared with other parameters.
+template <class... Params>
+struct DeclaringClass {
+  template <class C>
+  static C of(bool (C::*)(Params...));
+  static void of(...);
+};
+
+// Whether the file at path holds exactly size bytes of data.
+inline bool file_has_contents(kj::StringPtr path, const char* data,
+                              size_t size) {
+  int fd = open(path.cStr(), O_RDONLY);
+  if (fd < 0) {
     return false;
   }
+  auto _ = Finally([&](){ close(fd); });
+  struct stat info;
+  if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) != size) {
+    return false;
+  }
+  char buffer[1 << 16];
+  size_t offset = 0;
+  while (offset < size) {
+    ssize_t n = read(fd, buffer, kj::min(sizeof(buffer), size - offset));
+    if (n <= 0 || memcmp(buffer, data + offset, n) != 0) {
+      return false;
+    }
+    offset += n;
+  }
+  return true;
+}
 
-  virtual bool traverse_method(const Schema& schema, const InterfaceSchema::Method& method) {
-    const auto& interface = schema.asInterface();
-    PRE_VISIT(method, interface, method);
-    const auto& methodProto = method.getProto();
-    if (methodProto.hasImplicitParameters()) {
-      const auto& implicit = methodProto.getImplicitParameters();
-      PRE_VISIT(method_implicit_params, interface, method, implicit);
-      TRAVERSE(param_list, interface, kj::str("parameters"),
-          schemaLoader.getUnbound(methodProto.getParamStructType()).asStruct());
-      TRAVERSE(param_list, interface, kj::str("results"),
-          schemaLoader.getUnbound(methodProto.getResultStructType()).asStruct());
-      POST_VISIT(method_implicit_params, interface, method, implicit);
+// Like Cog.cog_process in dodo.py: leaves the file, and its mtime, alone
+// when it already has these contents. Returns whether it wrote.
+inline bool write_file_if_changed(kj::StringPtr path, const char* data,
+                                  size_t size) {
+  if (file_has_contents(path, data, size)) {
+    return false;
+  }
+  FILE* fd = fopen(path.cStr(), "w");
+  KJ_REQUIRE(fd != nullptr, "could not open output file", path);
+  size_t written = fwrite(data, 1, size, fd);
+  fclose(fd);
+  KJ_REQUIRE(written == size, "could not write output file", path);
+  return true;
+}
+
+// What a generator's write_output() wrote, so --stats and the benchmark can
+// tell writing the output apart from traversing the schema.
+struct OutputStats {
+  size_t files = 0;
+  size_t unchanged = 0;  // Of files, already up to date on disk.
+  size_t bytes = 0;
+  // Spent on the generating thread, writing or waiting for an OutputSink.
+  double ms = 0;
+  // Of files, written by an OutputSink's thread, and how long that took.
+  size_t background = 0;
+  double backgroundMs = 0;
+  // From handing a file to the OutputSink to it being written.
+  double latencyMs = 0;
+  double maxLatencyMs = 0;
+  // Times the generator had to wait for the OutputSink to catch up.
+  size_t stalls = 0;
+  OutputStats& operator+=(const OutputStats& other) {
+    files += other.files;
+    unchanged += other.unchanged;
+    bytes += other.bytes;
+    ms += other.ms;
+    background += other.background;
+    backgroundMs += other.backgroundMs;
+    latencyMs += other.latencyMs;
+    maxLatencyMs = std::max(maxLatencyMs, other.maxLatencyMs);
+    stalls += other.stalls;
+    return *this;
+  }
+};
+
+// Writes finished output files on a background thread, so that a generator
+// can format the next file while the last one goes to disk. Buffers are
+// swapped rather than copied: submit() takes the finished one and hands back
+// an empty one from the pool of already written ones, with its capacity
+// intact. At most queueLimit files wait to be written; submit() blocks while
+// the queue is full, and flush() until it is empty.
+class OutputSink {
+ public:
+  explicit OutputSink(size_t queueLimit)
+      : queueLimit_(kj::max(queueLimit, size_t(1))),
+        thread_([this]() { run(); }) {}
+  ~OutputSink() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+  }
+
+  // Queues buffer to be written to path, with write_file_if_changed, and
+  // leaves an empty buffer in its place.
+  void submit(kj::StringPtr path, std::string& buffer) {
+    Stopwatch stopwatch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queue_.size() >= queueLimit_) {
+      stats_.stalls++;
+      changed_.wait(lock, [this]() { return queue_.size() < queueLimit_; });
+    }
+    rethrow_error();
+    std::string next;
+    if (!free_.empty()) {
+      next = kj::mv(free_.back());
+      free_.pop_back();
     } else {
-      TRAVERSE(param_list, interface, kj::str("parameters"),
-          method.getParamType());
-      TRAVERSE(param_list, interface, kj::str("results"),
-          method.getResultType());
+      next.reserve(buffer.capacity());
+    }
+    stats_.files++;
+    stats_.background++;
+    stats_.bytes += buffer.size();
+    queue_.push_back(Job{kj::heapString(path), kj::mv(buffer), Stopwatch()});
+    buffer = kj::mv(next);
+    stats_.ms += stopwatch.elapsed_ms();
+    lock.unlock();
+    changed_.notify_all();
+  }
+
+  // Waits until everything submitted is on disk, and throws the first error
+  // writing any of it.
+  void flush() {
+    Stopwatch stopwatch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait(lock, [this]() { return queue_.empty(); });
+    stats_.ms += stopwatch.elapsed_ms();
+    rethrow_error();
+  }
+
+  OutputStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+ private:
+  struct Job {
+    kj::String path;
+    std::string buffer;
+    Stopwatch queued;
+  };
+
+  const size_t queueLimit_;
+  mutable std::mutex mutex_;
+  std::condition_variable changed_;
+  // The front job stays queued while it is being written.
+  std::deque<Job> queue_;
+  std::vector<std::string> free_;
+  OutputStats stats_;
+  kj::Maybe<kj::Exception> error_;
+  bool stopping_ = false;
+  std::thread thread_;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      changed_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      Job& job = queue_.front();
+      lock.unlock();
+      Stopwatch stopwatch;
+      bool written = false;
+      auto error = kj::runCatchingExceptions([&]() {
+        written = write_file_if_changed(job.path, job.buffer.data(),
+                                        job.buffer.size());
+      });
+      double ms = stopwatch.elapsed_ms();
+      double latencyMs = job.queued.elapsed_ms();
+      lock.lock();
+      if (error_ == nullptr) {
+        error_ = kj::mv(error);
+      }
+      if (!written) {
+        stats_.unchanged++;
+      }
+      stats_.backgroundMs += ms;
+      stats_.latencyMs += latencyMs;
+      stats_.maxLatencyMs = std::max(stats_.maxLatencyMs, latencyMs);
+      job.buffer.clear();
+      free_.push_back(kj::mv(job.buffer));
+      queue_.pop_front();
+      changed_.notify_all();
+    }
+  }
+
+  // With mutex_ held.
+  void rethrow_error() {
+    KJ_IF_MAYBE(exception, error_) {
+      auto copy = kj::mv(*exception);
+      error_ = nullptr;
+      kj::throwFatalException(kj::mv(copy));
+    }
+  }
+};
+
+// Calls enter_traverse() when created and leave_traverse() when the full
+// expression of the TRAVERSE that created it ends.
+template <class G>
+class TraverseFrame {
+ public:
+  TraverseFrame(G& generator, bool guarded)
+      : generator_(&generator), guarded_(guarded) {
+    generator.enter_traverse();
+  }
+  TraverseFrame(TraverseFrame&& other)
+      : generator_(other.generator_), guarded_(other.guarded_) {
+    other.generator_ = nullptr;
+  }
+  ~TraverseFrame() {
+    if (generator_ != nullptr) generator_->leave_traverse(guarded_);
+  }
+ private:
+  G* generator_;
+  bool guarded_;
+};
+
+// Where in the tree the traversal is: one frame per enclosing declaration,
+// field, method, parameter list, annotation or value, innermost last, each
+// tagged with the role it plays there. Names point into the request or the
+// SchemaLoader, so pushing a frame never copies one, and the frames' storage
+// is kept from one file to the next.
+class TraversalContext {
+ public:
+  enum Role : uint8_t {
+    REQUESTED_FILE,
+    DECL,
+    FIELD,
+    DEFAULT_VALUE,   // Of the enclosing FIELD.
+    CONST_VALUE,     // Of the enclosing DECL.
+    ENUMERANT,
+    METHOD,
+    PARAMS,          // Of the enclosing METHOD.
+    RESULTS,         // Likewise.
+    ANNOTATION,      // Named after the annotation's declaration.
+    ANNOTATION_VALUE,
+    ELEMENT,         // Of a list type or value; index is its position.
+    ELEMENT_TYPE,
+    VALUE_FIELD,     // A field set in a struct value.
+  };
+  struct Frame {
+    Role role;
+    kj::StringPtr name;  // Empty for values and element types.
+    uint32_t index;      // For ELEMENT and VALUE_FIELD.
+  };
+
+  // A file frame starts over, dropping whatever an exception in the
+  // previous file left behind.
+  void push(Role role, kj::StringPtr name, uint32_t index) {
+    if (role == REQUESTED_FILE) {
+      frames_.clear();
+    }
+    frames_.push_back(Frame{role, name, index});
+  }
+  void pop() { frames_.pop_back(); }
+
+  bool empty() const { return frames_.empty(); }
+  size_t depth() const { return frames_.size(); }
+  const Frame& top() const { return frames_.back(); }
+  // Outermost first.
+  kj::ArrayPtr<const Frame> frames() const {
+    return kj::arrayPtr(frames_.data(), frames_.size());
+  }
+  // The innermost frame with this role, if any.
+  const Frame* find(Role role) const {
+    for (size_t i = frames_.size(); i > 0; --i) {
+      if (frames_[i - 1].role == role) return &frames_[i - 1];
+    }
+    return nullptr;
+  }
+
+ private:
+  std::vector<Frame> frames_;
+};
+
+// Calls enter_context() when created and leave_context() when it goes out
+// of scope, including when a hook returns true.
+template <class G>
+class ContextScope {
+ public:
+  ContextScope(G& generator, TraversalContext::Role role,
+               kj::StringPtr name, uint32_t index)
+      : generator_(&generator) {
+    generator.enter_context(role, name, index);
+  }
+  ContextScope(ContextScope&& other) : generator_(other.generator_) {
+    other.generator_ = nullptr;
+  }
+  ~ContextScope() {
+    if (generator_ != nullptr) generator_->leave_context();
+  }
+ private:
+  G* generator_;
+};
+
+// The traversal itself. Every pre_visit/post_visit hook and every nested
+// traverse call goes through self(), so it is resolved against Derived at
+// compile time and the empty default hooks inline away. Derive from
+// StaticGenerator<YourGenerator> and define the hooks you need (they must be
+// public); derive from BaseGenerator instead to get virtual hooks.
+class BaseGenerator;
+template <class Derived>
+class StaticGenerator {
+  public:
+   StaticGenerator(SchemaLoader& schemaLoader)
+       : schemaLoader(schemaLoader), resolver(schemaLoader) {}
+  SchemaLoader &schemaLoader;
+  SchemaResolver resolver;
+
+  // Same as schemaLoader.get(id, brand, scope), but memoized.
+  Schema resolve(uint64_t id, const schema::Brand::Reader& brand,
+                 const Schema& scope) {
+    return resolver.get(id, brand, scope);
+  }
+
+  const SchemaResolver::Stats& resolution_stats() const {
+    return resolver.stats();
+  }
+
+  OutputStats output_stats() const {
+    OutputStats stats = outputStats_;
+    if (outputSink_ != nullptr) {
+      stats += outputSink_->stats();
+    }
+    return stats;
+  }
+
+  // Writes a finished output file in one go, unless it already has exactly
+  // these contents: rewriting it would only touch its mtime and make
+  // whatever depends on it rebuild.
+  void write_output(kj::StringPtr filename, const char* data, size_t size) {
+    Stopwatch stopwatch;
+    if (!write_file_if_changed(filename, data, size)) {
+      outputStats_.unchanged++;
+    }
+    outputStats_.files++;
+    outputStats_.bytes += size;
+    outputStats_.ms += stopwatch.elapsed_ms();
+    outputs_.push_back(kj::heapString(filename));
+  }
+
+  // Same as above for a generator that formats into a std::string, which is
+  // left empty, with its capacity, for the next file. After
+  // use_output_sink(), the write happens on the sink's thread instead.
+  void write_output(kj::StringPtr filename, std::string& buffer) {
+    if (outputSink_ == nullptr) {
+      write_output(filename, buffer.data(), buffer.size());
+      buffer.clear();
+    } else {
+      outputSink_->submit(filename, buffer);
+      outputs_.push_back(kj::heapString(filename));
+    }
+  }
+
+  // Writes outputs in the background from now on, letting up to queueLimit
+  // finished files wait for it; see OutputSink. 0 keeps writing them in
+  // write_output().
+  void use_output_sink(size_t queueLimit) {
+    outputSink_ = nullptr;
+    if (queueLimit > 0) {
+      outputSink_ = kj::heap<OutputSink>(queueLimit);
+    }
+  }
+
+  // Waits until every output is written. Called after each file when its
+  // outputs are stamped for --cache-dir, and after finish().
+  void flush_outputs() {
+    if (outputSink_ != nullptr) {
+      outputSink_->flush();
+    }
+  }
+
+  // Every file write_output() was given, in order, for the --cache-dir
+  // stamps.
+  const std::vector<kj::String>& outputs() const { return outputs_; }
+
+  // Bytes of output produced so far, for attributing output to hooks when
+  // profiling. Generators that format into a buffer should override it; it
+  // must only grow.
+  size_t bytes_emitted() const { return 0; }
+
+ private:
+  OutputStats outputStats_;
+  std::vector<kj::String> outputs_;
+  kj::Own<OutputSink> outputSink_;
+
+  // A list or struct value being walked by traverse_dynamic_value.
+  struct ValueFrame {
+    Type type;
+    DynamicValue::Reader value;
+    DynamicList::Reader list;
+    Type elementType;
+    DynamicStruct::Reader structValue;
+    StructSchema::FieldList fields;
+    uint32_t next;  // Element or field.
+  };
+
+  // Whether nested types and values go through the virtual traverse_*
+  // methods instead of the explicit stacks below.
+  constexpr static bool VIRTUAL_TRAVERSAL =
+      std::is_same<Derived, BaseGenerator>::value;
+
+  // Kept from one value to the next, so walking a constant only allocates
+  // when it nests deeper than any before it.
+  std::vector<ValueFrame> valueStack_;
+  std::vector<schema::Type::Reader> typeStack_;
+  TraversalContext context_;
+
+  // Pushes a frame for a list or struct; false for anything else.
+  bool push_value(const Type& type, const DynamicValue::Reader& value) {
+    switch (type.which()) {
+      case schema::Type::LIST: {
+        valueStack_.emplace_back();
+        auto& frame = valueStack_.back();
+        frame.list = value.as<DynamicList>();
+        frame.elementType = type.asList().getElementType();
+        break;
+      }
+      case schema::Type::STRUCT: {
+        valueStack_.emplace_back();
+        auto& frame = valueStack_.back();
+        frame.structValue = value.as<DynamicStruct>();
+        frame.fields = type.asStruct().getFields();
+        break;
+      }
+      default:
+        return false;
+    }
+    auto& frame = valueStack_.back();
+    frame.type = type;
+    frame.value = value;
+    frame.next = 0;
+    return true;
+  }
+
+  // The frame's next element, or next field that is set, and its name.
+  static bool next_value(ValueFrame& frame, Type& type,
+                         DynamicValue::Reader& value, kj::StringPtr& name) {
+    if (frame.type.which() == schema::Type::LIST) {
+      if (frame.next == frame.list.size()) return false;
+      type = frame.elementType;
+      value = frame.list[frame.next++];
+      name = nullptr;
+      return true;
+    }
+    while (frame.next < frame.fields.size()) {
+      auto field = frame.fields[frame.next++];
+      if (frame.structValue.has(field)) {
+        type = field.getType();
+        value = frame.structValue.get(field);
+        name = field.getProto().getName();
+        return true;
+      }
     }
-    TRAVERSE(annotations, schema, methodProto.getAnnotations());
-    POST_VISIT(method, interface, method);
     return false;
   }
 
-  virtual bool traverse_param_list(
-      const InterfaceSchema& interface,
-      const kj::String& name, const StructSchema& schema) {
-    PRE_VISIT(param_list, interface, name, schema);
-    TRAVERSE(struct_fields, schema);
-    POST_VISIT(param_list, interface, name, schema);
+  // traverse_type's walk of the element types below type, for a
+  // StaticGenerator.
+  void walk_element_types(const Schema& schema,
+                          const schema::Type::Reader& type) {
+    // Hooks may start a traversal of their own, which stacks above base.
+    size_t base = typeStack_.size();
+    auto _ = Finally([&]() { typeStack_.resize(base); });
+    auto element = type;
+    while (element.which() == schema::Type::LIST) {
+      element = element.getList().getElementType();
+      self().enter_traverse();
+      self().enter_context(TraversalContext::ELEMENT_TYPE, nullptr, 0);
+      if (self().pre_visit_type(schema, element)) {
+        self().leave_context();
+        self().leave_traverse(false);
+        break;
+      }
+      typeStack_.push_back(element);
+    }
+    while (typeStack_.size() > base) {
+      element = typeStack_.back();
+      typeStack_.pop_back();
+      self().post_visit_type(schema, element);
+      self().leave_context();
+      self().leave_traverse(false);
+    }
+  }
+
+  // traverse_dynamic_value's walk of the lists and structs inside value, for
+  // a StaticGenerator.
+  void walk_values(const Schema& schema, const Type& type,
+                   const DynamicValue::Reader& value) {
+    size_t base = valueStack_.size();
+    auto _ = Finally([&]() {
+      valueStack_.erase(valueStack_.begin() + base, valueStack_.end());
+    });
+    push_value(type, value);
+    while (valueStack_.size() > base) {
+      Type childType;
+      DynamicValue::Reader child;
+      kj::StringPtr name;
+      auto& frame = valueStack_.back();
+      if (!next_value(frame, childType, child, name)) {
+        // Copied out, a hook may grow the stack.
+        childType = frame.type;
+        child = frame.value;
+        valueStack_.pop_back();
+        if (valueStack_.size() > base) {
+          self().post_visit_dynamic_value(schema, childType, child);
+          self().leave_context();
+          self().leave_traverse(false);
+        }
+        continue;
+      }
+      self().enter_traverse();
+      self().enter_context(frame.type.which() == schema::Type::LIST
+                               ? TraversalContext::ELEMENT
+                               : TraversalContext::VALUE_FIELD,
+                           name, frame.next - 1);
+      if (visit_typed_value(schema, childType, child) ||
+          self().pre_visit_dynamic_value(schema, childType, child)) {
+        self().leave_context();
+        self().leave_traverse(false);
+      } else if (!push_value(childType, child)) {
+        self().post_visit_dynamic_value(schema, childType, child);
+        self().leave_context();
+        self().leave_traverse(false);
+      }
+    }
+  }
+
+ public:
+
+  // Command line options of the generator. Derived generators can declare
+  // their own Options, register them in add_options and take them as a
+  // second constructor argument.
+  struct Options {};
+  static void add_options(kj::MainBuilder&, Options&) {}
+  // Everything in Options that changes the output, for the --cache-dir key.
+  static kj::String options_key(const Options&) { return kj::str(); }
+
+  // The hooks the traversal needs to call. By default, the ones Derived
+  // defines itself; declare interest_mask() in Derived to override that,
+  // e.g. when it overrides traverse_* methods or overloads a hook.
+  HookMask interest_mask() const { return defined_hooks<Derived>(); }
+
+  bool interested(HookMask hooks) {
+    return (self().interest_mask() & hooks) != 0;
+  }
+
+  template <class D>
+  constexpr static HookMask defined_hooks() {
+    return
+        /*[[[cog
+        for method in visit_methods:
+          cog.outl('(DEFINES_HOOK(D, %s) ? HOOK_%s : 0) |' % (
+              method, method.upper()))
+        ]]]*/
+        (DEFINES_HOOK(D, file) ? HOOK_FILE : 0) |
+        (DEFINES_HOOK(D, imports) ? HOOK_IMPORTS : 0) |
+        (DEFINES_HOOK(D, import) ? HOOK_IMPORT : 0) |
+        (DEFINES_HOOK(D, nested_decls) ? HOOK_NESTED_DECLS : 0) |
+        (DEFINES_HOOK(D, decl) ? HOOK_DECL : 0) |
+        (DEFINES_HOOK(D, struct_decl) ? HOOK_STRUCT_DECL : 0) |
+        (DEFINES_HOOK(D, enum_decl) ? HOOK_ENUM_DECL : 0) |
+        (DEFINES_HOOK(D, const_decl) ? HOOK_CONST_DECL : 0) |
+        (DEFINES_HOOK(D, annotation_decl) ? HOOK_ANNOTATION_DECL : 0) |
+        (DEFINES_HOOK(D, annotation) ? HOOK_ANNOTATION : 0) |
+        (DEFINES_HOOK(D, annotations) ? HOOK_ANNOTATIONS : 0) |
+        (DEFINES_HOOK(D, type) ? HOOK_TYPE : 0) |
+        (DEFINES_HOOK(D, dynamic_value) ? HOOK_DYNAMIC_VALUE : 0) |
+        (DEFINES_HOOK(D, struct_fields) ? HOOK_STRUCT_FIELDS : 0) |
+        (DEFINES_HOOK(D, struct_default_value) ? HOOK_STRUCT_DEFAULT_VALUE : 0) |
+        (DEFINES_HOOK(D, struct_field) ? HOOK_STRUCT_FIELD : 0) |
+        (DEFINES_HOOK(D, struct_field_slot) ? HOOK_STRUCT_FIELD_SLOT : 0) |
+        (DEFINES_HOOK(D, struct_field_group) ? HOOK_STRUCT_FIELD_GROUP : 0) |
+        (DEFINES_HOOK(D, struct_field_union) ? HOOK_STRUCT_FIELD_UNION : 0) |
+        (DEFINES_HOOK(D, interface_decl) ? HOOK_INTERFACE_DECL : 0) |
+        (DEFINES_HOOK(D, param_list) ? HOOK_PARAM_LIST : 0) |
+        (DEFINES_HOOK(D, method) ? HOOK_METHOD : 0) |
+        (DEFINES_HOOK(D, methods) ? HOOK_METHODS : 0) |
+        (DEFINES_HOOK(D, method_implicit_params) ? HOOK_METHOD_IMPLICIT_PARAMS : 0) |
+        (DEFINES_HOOK(D, enumerant) ? HOOK_ENUMERANT : 0) |
+        (DEFINES_HOOK(D, enumerants) ? HOOK_ENUMERANTS : 0) |
+        //[[[end]]]
+        /*[[[cog
+        for name, _, _ in scalar_types:
+          cog.outl('(DEFINES_TYPED_HOOK(D, visit_%s_value) ? HOOK_TYPED_VALUE : 0) |' % name)
+        for name, _, _ in primitive_types:
+          cog.outl('(DEFINES_TYPED_HOOK(D, visit_%s_list) ? HOOK_TYPED_VALUE : 0) |' % name)
+        ]]]*/
+        (DEFINES_TYPED_HOOK(D, visit_bool_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_int8_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_int16_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_int32_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_int64_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_uint8_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_uint16_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_uint32_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_uint64_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_float32_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_float64_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_text_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_data_value) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_bool_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_int8_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_int16_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_int32_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_int64_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_uint8_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_uint16_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_uint32_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_uint64_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_float32_list) ? HOOK_TYPED_VALUE : 0) |
+        (DEFINES_TYPED_HOOK(D, visit_float64_list) ? HOOK_TYPED_VALUE : 0) |
+        //[[[end]]]
+        0;
+  }
+
+  // Whether D replaces any of the traverse_* methods, which a wrapper running
+  // the traversal in its place would leave out.
+  template <class D>
+  constexpr static bool overrides_traversal() {
+    return
+        /*[[[cog
+        for method, args in traverse_methods:
+          cog.outl('OVERRIDES_TRAVERSE(D, %s, %s) ||' % (
+              method, ', '.join('const %s&' % arg for arg in args)))
+        ]]]*/
+        OVERRIDES_TRAVERSE(D, file, const Schema&, const RequestedFile&) ||
+        OVERRIDES_TRAVERSE(D, imports, const Schema&, const List<Import>::Reader&) ||
+        OVERRIDES_TRAVERSE(D, nested_decls, const Schema&) ||
+        OVERRIDES_TRAVERSE(D, decl, const Schema&, const NestedNode&) ||
+        OVERRIDES_TRAVERSE(D, struct_decl, const Schema&, const NestedNode&) ||
+        OVERRIDES_TRAVERSE(D, enum_decl, const Schema&, const NestedNode&) ||
+        OVERRIDES_TRAVERSE(D, const_decl, const Schema&, const NestedNode&) ||
+        OVERRIDES_TRAVERSE(D, annotation_decl, const Schema&, const NestedNode&) ||
+        OVERRIDES_TRAVERSE(D, annotations, const Schema&) ||
+        OVERRIDES_TRAVERSE(D, annotations, const Schema&, const List<schema::Annotation>::Reader&) ||
+        OVERRIDES_TRAVERSE(D, annotation, const schema::Annotation::Reader&, const Schema&) ||
+        OVERRIDES_TRAVERSE(D, type, const Schema&, const schema::Type::Reader&) ||
+        OVERRIDES_TRAVERSE(D, dynamic_value, const Schema&, const Type&, const DynamicValue::Reader&) ||
+        OVERRIDES_TRAVERSE(D, value, const Schema&, const Type&, const schema::Value::Reader&) ||
+        OVERRIDES_TRAVERSE(D, struct_fields, const StructSchema&) ||
+        OVERRIDES_TRAVERSE(D, struct_field, const StructSchema&, const StructSchema::Field&) ||
+        OVERRIDES_TRAVERSE(D, interface_decl, const Schema&, const NestedNode&) ||
+        OVERRIDES_TRAVERSE(D, method, const Schema&, const InterfaceSchema::Method&) ||
+        OVERRIDES_TRAVERSE(D, param_list, const InterfaceSchema&, const kj::StringPtr&, const StructSchema&) ||
+        OVERRIDES_TRAVERSE(D, enumerants, const Schema&, const EnumSchema::EnumerantList&) ||
+        //[[[end]]]
+        false;
+  }
+
+  // Set by CapnpcGenericMain. When present the traversal walks nested
+  // declarations through it instead of looking each one up in the loader.
+  const SchemaIndex* schemaIndex = nullptr;
+
+  // Same as schemaLoader.getUnbound(id), from the index when it has the node.
+  Schema get_unbound(uint64_t id) const {
+    if (schemaIndex != nullptr) {
+      if (const auto* entry = schemaIndex->find(id)) {
+        return entry->schema;
+      }
+    }
+    return schemaLoader.getUnbound(id);
+  }
+
+  const static auto TRAVERSAL_LIMIT = 1 << 30;  // Don't limit.
+  constexpr static const char *TITLE = "Generator title";
+  constexpr static const char *DESCRIPTION = "Generator description";
+  // Set this when each traverse_file only writes that file's own output and
+  // finish() has nothing to merge, so that --jobs can give every worker
+  // thread its own generator instance.
+  constexpr static bool PARALLEL_SAFE = false;
+  // Set this when, in addition, all of a file's output goes through
+  // write_output() and only depends on the file's nodes and options_key(),
+  // so that --cache-dir can skip files whose inputs did not change.
+  constexpr static bool CACHEABLE = false;
+
+  typedef schema::CodeGeneratorRequest::RequestedFile::Reader RequestedFile;
+  bool traverse_file(
+      const Schema& file, const RequestedFile& requestedFile) {
+    auto _ = context_scope(TraversalContext::REQUESTED_FILE,
+                           requestedFile.getFilename());
+    PRE_VISIT(file, file, requestedFile);
+    TRAVERSE(imports, file, requestedFile.getImports());
+    const auto& proto = file.getProto();
+    TRAVERSE(nested_decls, file);
+    TRAVERSE(annotations, file, proto.getAnnotations());
+    POST_VISIT(file, file, requestedFile);
     return false;
   }
 
-  virtual bool traverse_enumerants(const Schema& schema, const EnumSchema::EnumerantList& enumList) {
-    PRE_VISIT(enumerants, schema, enumList);
-    for (const auto& enumerant : enumList) {
-      PRE_VISIT(enumerant, schema, enumerant);
-      const auto& proto = enumerant.getProto();
-      TRAVERSE(annotations, schema, proto.getAnnotations());
-      POST_VISIT(enumerant, schema, enumerant);
+  void finish() {}
+
+  // Called around every nested traverse_* call, for wrappers that need to
+  // know which traversal frame a hook runs in (see Multi). guarded is set
+  // when a true result makes the caller return as well.
+  void enter_traverse() {}
+  void leave_traverse(bool guarded) {}
+  TraverseFrame<Derived> traverse_frame(bool guarded) {
+    return TraverseFrame<Derived>(self(), guarded);
+  }
+
+  // Where the hook being called is, see TraversalContext.
+  const TraversalContext& context() const { return context_; }
+  // Called as the traversal enters and leaves each frame of the context,
+  // before the frame's pre_visit hook and after its post_visit hook.
+  // Wrappers forward them to the generators they run.
+  void enter_context(TraversalContext::Role role, kj::StringPtr name,
+                     uint32_t index) {
+    context_.push(role, name, index);
+  }
+  void leave_context() { context_.pop(); }
+  ContextScope<Derived> context_scope(TraversalContext::Role role,
+                                      kj::StringPtr name = nullptr,
+                                      uint32_t index = 0) {
+    return ContextScope<Derived>(self(), role, name, index);
+  }
+
+  typedef schema::CodeGeneratorRequest::RequestedFile::Import Import;
+  bool traverse_imports(const Schema& schema, const List<Import>::Reader& imports) {
+    PRE_VISIT(imports, schema, imports);
+    for (const auto& import : imports) {
+      PRE_VISIT(import, schema, import);
+      POST_VISIT(import, schema, import);
     }
-    POST_VISIT(enumerants, schema, enumList);
+    POST_VISIT(imports, schema, imports);
     return false;
   }
 
-  /*[[[cog
-  def output_method(method, args):
-    cog.outl('virtual bool %s(const %s&) { return false; }' % (
-        method, '&, const '.join(args)))
-  for method, args in visit_methods.items():
-    output_method('pre_visit_%s' % method, args)
-  for method, args in visit_methods.items():
-    output_method('post_visit_%s' % method, args)
-  ]]]*/
-  virtual bool pre_visit_file(const Schema&, const schema::CodeGeneratorRequest::RequestedFile::Reader&) { return false; }
-  virtual bool pre_visit_imports(const Schema&, const List<Import>::Reader&) { return false; }
-  virtual bool pre_visit_import(const Schema&, const Import::Reader&) { return false; }
-  virtual bool pre_visit_nested_decls(const Schema&) { return false; }
-  virtual bool pre_visit_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool pre_visit_struct_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool pre_visit_enum_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool pre_visit_const_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool pre_visit_annotation_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool pre_visit_annotation(const schema::Annotation::Reader&, const Schema&) { return false; }
-  virtual bool pre_visit_annotations(const Schema&) { return false; }
-  virtual bool pre_visit_type(const Schema&, const schema::Type::Reader&) { return false; }
-  virtual bool pre_visit_dynamic_value(const Schema&, const Type&, const DynamicValue::Reader&) { return false; }
-  virtual bool pre_visit_struct_fields(const StructSchema&) { return false; }
-  virtual bool pre_visit_struct_default_value(const StructSchema&, const StructSchema::Field&) { return false; }
-  virtual bool pre_visit_struct_field(const StructSchema&, const StructSchema::Field&) { return false; }
-  virtual bool pre_visit_struct_field_slot(const StructSchema&, const StructSchema::Field&, const schema::Field::Slot::Reader&) { return false; }
-  virtual bool pre_visit_struct_field_group(const StructSchema&, const StructSchema::Field&, const schema::Field::Group::Reader&, const Schema&) { return false; }
-  virtual bool pre_visit_struct_field_union(const StructSchema&) { return false; }
-  virtual bool pre_visit_interface_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool pre_visit_param_list(const InterfaceSchema&, const kj::String&, const StructSchema&) { return false; }
-  virtual bool pre_visit_method(const InterfaceSchema&, const InterfaceSchema::Method&) { return false; }
-  virtual bool pre_visit_methods(const InterfaceSchema&) { return false; }
-  virtual bool pre_visit_method_implicit_params(const InterfaceSchema&, const InterfaceSchema::Method&, const List<schema::Node::Parameter>::Reader&) { return false; }
-  virtual bool pre_visit_enumerant(const Schema&, const EnumSchema::Enumerant&) { return false; }
-  virtual bool pre_visit_enumerants(const Schema&, const EnumSchema::EnumerantList&) { return false; }
-  virtual bool post_visit_file(const Schema&, const schema::CodeGeneratorRequest::RequestedFile::Reader&) { return false; }
-  virtual bool post_visit_imports(const Schema&, const List<Import>::Reader&) { return false; }
-  virtual bool post_visit_import(const Schema&, const Import::Reader&) { return false; }
-  virtual bool post_visit_nested_decls(const Schema&) { return false; }
-  virtual bool post_visit_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool post_visit_struct_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool post_visit_enum_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool post_visit_const_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool post_visit_annotation_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool post_visit_annotation(const schema::Annotation::Reader&, const Schema&) { return false; }
-  virtual bool post_visit_annotations(const Schema&) { return false; }
-  virtual bool post_visit_type(const Schema&, const schema::Type::Reader&) { return false; }
-  virtual bool post_visit_dynamic_value(const Schema&, const Type&, const DynamicValue::Reader&) { return false; }
-  virtual bool post_visit_struct_fields(const StructSchema&) { return false; }
-  virtual bool post_visit_struct_default_value(const StructSchema&, const StructSchema::Field&) { return false; }
-  virtual bool post_visit_struct_field(const StructSchema&, const StructSchema::Field&) { return false; }
-  virtual bool post_visit_struct_field_slot(const StructSchema&, const StructSchema::Field&, const schema::Field::Slot::Reader&) { return false; }
-  virtual bool post_visit_struct_field_group(const StructSchema&, const StructSchema::Field&, const schema::Field::Group::Reader&, const Schema&) { return false; }
-  virtual bool post_visit_struct_field_union(const StructSchema&) { return false; }
-  virtual bool post_visit_interface_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
-  virtual bool post_visit_param_list(const InterfaceSchema&, const kj::String&, const StructSchema&) { return false; }
-  virtual bool post_visit_method(const InterfaceSchema&, const InterfaceSchema::Method&) { return false; }
-  virtual bool post_visit_methods(const InterfaceSchema&) { return false; }
-  virtual bool post_visit_method_implicit_params(const InterfaceSchema&, const InterfaceSchema::Method&, const List<schema::Node::Parameter>::Reader&) { return false; }
-  virtual bool post_visit_enumerant(const Schema&, const EnumSchema::Enumerant&) { return false; }
-  virtual bool post_visit_enumerants(const Schema&, const EnumSchema::EnumerantList&) { return false; }
+  bool traverse_nested_decls(const Schema& schema) {
+    const auto& proto = schema.getProto();
+    const SchemaIndex::Entry* entry =
+        schemaIndex == nullptr ? nullptr : schemaIndex->find(proto.getId());
+    if (entry != nullptr) {
+      // Same walk, straight down the index's contiguous child range.
+      if (entry->nestedCount == 0) return false;
+      PRE_VISIT(nested_decls, schema);
+      bool scope = entry->selection == SchemaIndex::SCOPE;
+      for (const auto& child : schemaIndex->nested(*entry)) {
+        if (scope && child.selection == SchemaIndex::UNSELECTED) continue;
+        GUARD_FALSE(TRAVERSE_GUARDED(decl, child.schema, child.decl));
+      }
+      POST_VISIT(nested_decls, schema);
+      return false;
+    }
+    const auto& nodes = proto.getNestedNodes();
+    if (nodes.size() == 0) return false;
+    PRE_VISIT(nested_decls, schema);
+    for (const auto& decl : nodes) {
+      GUARD_FALSE(TRAVERSE_GUARDED(
+          decl, schemaLoader.getUnbound(decl.getId()), decl));
+    }
+    POST_VISIT(nested_decls, schema);
+    return false;
+  }
+
+  typedef schema::Node::NestedNode::Reader NestedNode;
+  bool traverse_decl(const Schema& schema, const NestedNode& decl) {
+    const auto& proto = schema.getProto();
+    auto _ = context_scope(TraversalContext::DECL, decl.getName());
+    PRE_VISIT(decl, schema, decl);
+    switch (proto.which()) {
+      case schema::Node::FILE:
+        break;
+      case schema::Node::STRUCT: {
+        TRAVERSE(struct_decl, schema, decl); break;
+      }
+      case schema::Node::ENUM: {
+        TRAVERSE(enum_decl, schema, decl); break;
+      }
+      case schema::Node::INTERFACE: {
+        TRAVERSE(interface_decl, schema, decl); break;
+      }
+      case schema::Node::CONST: {
+        TRAVERSE(const_decl, schema, decl); break;
+      }
+      case schema::Node::ANNOTATION: {
+        TRAVERSE(annotation_decl, schema, decl); break;
+      }
+    }
+    POST_VISIT(decl, schema, decl);
+    return false;
+  }
+
+  bool traverse_struct_decl(const Schema& schema, const NestedNode& decl) {
+    PRE_VISIT(struct_decl, schema, decl);
+    TRAVERSE(nested_decls, schema);
+    TRAVERSE(struct_fields, schema.asStruct());
+    TRAVERSE(annotations, schema);
+    POST_VISIT(struct_decl, schema, decl);
+    return false;
+  }
+
+  bool traverse_enum_decl(const Schema& schema, const NestedNode& decl) {
+    PRE_VISIT(enum_decl, schema, decl);
+    TRAVERSE(nested_decls, schema);
+    TRAVERSE(enumerants, schema, schema.asEnum().getEnumerants());
+    TRAVERSE(annotations, schema);
+    POST_VISIT(enum_decl, schema, decl);
+    return false;
+  }
+
+  bool traverse_const_decl(const Schema& schema, const NestedNode& decl) {
+    const auto& proto = schema.getProto();
+    PRE_VISIT(const_decl, schema, decl);
+    TRAVERSE(type, schema, proto.getConst().getType());
+    {
+      auto _ = context_scope(TraversalContext::CONST_VALUE);
+      TRAVERSE(value, schema, proto.getConst().getType(),
+               proto.getConst().getValue());
+    }
+    TRAVERSE(annotations, schema);
+    POST_VISIT(const_decl, schema, decl);
+    return false;
+  }
+
+  bool traverse_annotation_decl(const Schema& schema, const NestedNode& decl ) {
+    PRE_VISIT(annotation_decl, schema, decl);
+    TRAVERSE(type, schema, schema.getProto().getAnnotation().getType());
+    TRAVERSE(annotations, schema);
+    POST_VISIT(annotation_decl, schema, decl);
+    return false;
+  }
+
+  bool traverse_annotations(const Schema& schema) {
+    TRAVERSE(annotations, schema, schema.getProto().getAnnotations());
+    return false;
+  }
+
+  bool traverse_annotations(
+      const Schema& schema, const List<schema::Annotation>::Reader& annotations) {
+    if (annotations.size() == 0 || !interested(ANNOTATION_HOOKS)) return false;
+    PRE_VISIT(annotations, schema);
+    for (const auto& ann : annotations) {
+      const auto& annSchema = resolve(ann.getId(), ann.getBrand(), schema);
+      TRAVERSE(annotation, ann, annSchema);
+    }
+    POST_VISIT(annotations, schema);
+    return false;
+  }
+
+  bool traverse_annotation(const schema::Annotation::Reader& annotation, const Schema& parent) {
+    const auto& decl = resolve(annotation.getId(), annotation.getBrand(), parent);
+    auto _ = context_scope(TraversalContext::ANNOTATION,
+                           decl.getShortDisplayName());
+    PRE_VISIT(annotation, annotation, parent);
+    const auto& annDecl = decl.getProto().getAnnotation();
+    {
+      auto _ = context_scope(TraversalContext::ANNOTATION_VALUE);
+      TRAVERSE(value, parent, annDecl.getType(), annotation.getValue());
+    }
+    POST_VISIT(annotation, annotation, parent);
+    return false;
+  }
+
+  // A StaticGenerator walks the element types of nested lists off typeStack_
+  // instead of by recursion, each bracketed by enter_traverse()/
+  // leave_traverse() as if it were a nested traverse_type call. The hooks
+  // fire in the same order. BaseGenerator recurses through its virtual
+  // traverse_type, so that overrides of it see every element type.
+  bool traverse_type(
+      const Schema& schema, const schema::Type::Reader& type) {
+    if (!interested(HOOK_TYPE)) return false;
+    PRE_VISIT(type, schema, type);
+    if (!VIRTUAL_TRAVERSAL) {
+      walk_element_types(schema, type);
+    } else if (type.which() == schema::Type::LIST) {
+      auto _ = context_scope(TraversalContext::ELEMENT_TYPE);
+      TRAVERSE(type, schema, type.getList().getElementType());
+    }
+    POST_VISIT(type, schema, type);
+    return false;
+  }
+
+  // Likewise, a StaticGenerator walks nested list elements and struct fields
+  // off valueStack_, one frame per list or struct being walked, and
+  // BaseGenerator recurses through traverse_dynamic_value. Either way each
+  // nested value is in an ELEMENT or VALUE_FIELD context.
+  bool traverse_dynamic_value(const Schema& schema, const Type& type, const DynamicValue::Reader& value) {
+    if (visit_typed_value(schema, type, value)) return false;
+    PRE_VISIT(dynamic_value, schema, type, value);
+    if (!VIRTUAL_TRAVERSAL) {
+      walk_values(schema, type, value);
+    } else if (type.which() == schema::Type::LIST) {
+      auto elementType = type.asList().getElementType();
+      auto list = value.as<DynamicList>();
+      for (uint32_t i = 0; i < list.size(); i++) {
+        auto _ = context_scope(TraversalContext::ELEMENT, nullptr, i);
+        TRAVERSE(dynamic_value, schema, elementType, list[i]);
+      }
+    } else if (type.which() == schema::Type::STRUCT) {
+      auto structValue = value.as<DynamicStruct>();
+      auto fields = type.asStruct().getFields();
+      for (uint32_t i = 0; i < fields.size(); i++) {
+        auto field = fields[i];
+        if (structValue.has(field)) {
+          auto _ = context_scope(TraversalContext::VALUE_FIELD,
+                                 field.getProto().getName(), i);
+          TRAVERSE(dynamic_value, schema, field.getType(),
+                   structValue.get(field));
+        }
+      }
+    }
+    POST_VISIT(dynamic_value, schema, type, value);
+    return false;
+  }
+
+  // Offers a scalar, or a list of primitives as a whole, to the typed hooks.
+  // True when the generator took it, and its DynamicValue hooks and those of
+  // its elements are not called.
+  bool visit_typed_value(const Schema& schema, const Type& type,
+                         const DynamicValue::Reader& value) {
+    if (!interested(HOOK_TYPED_VALUE)) return false;
+    switch (type.which()) {
+      /*[[[cog
+      for name, as_type, _ in scalar_types:
+        cog.outl('case schema::Type::%s:' % name.upper())
+        cog.outl('  return self().visit_%s_value(schema, type, value.as<%s>());' % (name, as_type))
+      ]]]*/
+      case schema::Type::BOOL:
+        return self().visit_bool_value(schema, type, value.as<bool>());
+      case schema::Type::INT8:
+        return self().visit_int8_value(schema, type, value.as<int8_t>());
+      case schema::Type::INT16:
+        return self().visit_int16_value(schema, type, value.as<int16_t>());
+      case schema::Type::INT32:
+        return self().visit_int32_value(schema, type, value.as<int32_t>());
+      case schema::Type::INT64:
+        return self().visit_int64_value(schema, type, value.as<int64_t>());
+      case schema::Type::UINT8:
+        return self().visit_uint8_value(schema, type, value.as<uint8_t>());
+      case schema::Type::UINT16:
+        return self().visit_uint16_value(schema, type, value.as<uint16_t>());
+      case schema::Type::UINT32:
+        return self().visit_uint32_value(schema, type, value.as<uint32_t>());
+      case schema::Type::UINT64:
+        return self().visit_uint64_value(schema, type, value.as<uint64_t>());
+      case schema::Type::FLOAT32:
+        return self().visit_float32_value(schema, type, value.as<float>());
+      case schema::Type::FLOAT64:
+        return self().visit_float64_value(schema, type, value.as<double>());
+      case schema::Type::TEXT:
+        return self().visit_text_value(schema, type, value.as<Text>());
+      case schema::Type::DATA:
+        return self().visit_data_value(schema, type, value.as<Data>());
+      //[[[end]]]
+      case schema::Type::LIST: {
+        const auto& list = value.as<DynamicList>();
+        switch (type.asList().getElementType().which()) {
+          /*[[[cog
+          for name, as_type, _ in primitive_types:
+            cog.outl('case schema::Type::%s:' % name.upper())
+            cog.outl('  return self().visit_%s_list(schema, type, list.as<List<%s>>());' % (name, as_type))
+          ]]]*/
+          case schema::Type::BOOL:
+            return self().visit_bool_list(schema, type, list.as<List<bool>>());
+          case schema::Type::INT8:
+            return self().visit_int8_list(schema, type, list.as<List<int8_t>>());
+          case schema::Type::INT16:
+            return self().visit_int16_list(schema, type, list.as<List<int16_t>>());
+          case schema::Type::INT32:
+            return self().visit_int32_list(schema, type, list.as<List<int32_t>>());
+          case schema::Type::INT64:
+            return self().visit_int64_list(schema, type, list.as<List<int64_t>>());
+          case schema::Type::UINT8:
+            return self().visit_uint8_list(schema, type, list.as<List<uint8_t>>());
+          case schema::Type::UINT16:
+            return self().visit_uint16_list(schema, type, list.as<List<uint16_t>>());
+          case schema::Type::UINT32:
+            return self().visit_uint32_list(schema, type, list.as<List<uint32_t>>());
+          case schema::Type::UINT64:
+            return self().visit_uint64_list(schema, type, list.as<List<uint64_t>>());
+          case schema::Type::FLOAT32:
+            return self().visit_float32_list(schema, type, list.as<List<float>>());
+          case schema::Type::FLOAT64:
+            return self().visit_float64_list(schema, type, list.as<List<double>>());
+          //[[[end]]]
+          default:
+            return false;
+        }
+      }
+      default:
+        return false;
+    }
+  }
+
+  inline bool traverse_value(const Schema& schema, const schema::Type::Reader& type, const schema::Value::Reader& value) {
+    return TRAVERSE(value, schema, schemaLoader.getType(type, schema), value);
+  }
+
+  bool traverse_value(const Schema& schema, const Type& type, const schema::Value::Reader& value) {
+    if (!interested(VALUE_HOOKS)) return false;
+    switch (value.which()) {
+      case schema::Value::VOID:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getVoid()));
+        break;
+      /*[[[cog
+      for name, _, _ in scalar_types:
+        getter = 'value.get%s()' % name.title()
+        cog.outl('case schema::Value::%s:' % name.upper())
+        cog.outl('  TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(%s));' % getter)
+        cog.outl('  break;')
+      ]]]*/
+      case schema::Value::BOOL:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getBool()));
+        break;
+      case schema::Value::INT8:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getInt8()));
+        break;
+      case schema::Value::INT16:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getInt16()));
+        break;
+      case schema::Value::INT32:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getInt32()));
+        break;
+      case schema::Value::INT64:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getInt64()));
+        break;
+      case schema::Value::UINT8:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getUint8()));
+        break;
+      case schema::Value::UINT16:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getUint16()));
+        break;
+      case schema::Value::UINT32:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getUint32()));
+        break;
+      case schema::Value::UINT64:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getUint64()));
+        break;
+      case schema::Value::FLOAT32:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getFloat32()));
+        break;
+      case schema::Value::FLOAT64:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getFloat64()));
+        break;
+      case schema::Value::TEXT:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getText()));
+        break;
+      case schema::Value::DATA:
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(value.getData()));
+        break;
+      //[[[end]]]
+      case schema::Value::LIST: {
+        const auto& listValue = value.getList().getAs<DynamicList>(type.asList());
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(listValue));
+        break;
+      }
+      case schema::Value::ENUM: {
+        const auto& dynamicEnum = DynamicEnum(type.asEnum(), value.getEnum());
+        TRAVERSE(dynamic_value, schema, type, DynamicValue::Reader(dynamicEnum));
+        break;
+      }
+      case schema::Value::STRUCT: {
+        TRAVERSE(dynamic_value, schema, type, value.getStruct().getAs<DynamicStruct>(type.asStruct()));
+        break;
+      }
+      case schema::Value::INTERFACE:
+      case schema::Value::ANY_POINTER:
+        // These cannot be serialized in a schema file.
+        break;
+    }
+    return false;
+  }
+
+  bool traverse_struct_fields(
+      const StructSchema& schema) {
+    if (!interested(FIELD_HOOKS)) return false;
+    PRE_VISIT(struct_fields, schema);
+    const auto& unionFields = schema.getUnionFields();
+    if (unionFields.size() > 0) {
+      PRE_VISIT(struct_field_union, schema);
+      for (const auto& field : unionFields) {
+        TRAVERSE(struct_field, schema, field);
+      }
+      POST_VISIT(struct_field_union, schema);
+    }
+    for (const auto& field : schema.getNonUnionFields()) {
+      TRAVERSE(struct_field, schema, field);
+    }
+    POST_VISIT(struct_fields, schema);
+    return false;
+  }
+
+  bool traverse_struct_field(
+      const StructSchema& schema, const StructSchema::Field& field) {
+    auto proto = field.getProto();
+    auto _ = context_scope(TraversalContext::FIELD, proto.getName());
+    PRE_VISIT(struct_field, schema, field);
+    switch (proto.which()) {
+      case schema::Field::SLOT: {
+        auto slot = proto.getSlot();
+        PRE_VISIT(struct_field_slot, schema, field, slot);
+        TRAVERSE(type, schema, slot.getType());
+        if (slot.getHadExplicitDefault()) {
+          auto _ = context_scope(TraversalContext::DEFAULT_VALUE);
+          PRE_VISIT(struct_default_value, schema, field);
+          TRAVERSE(value, schema, slot.getType(), slot.getDefaultValue());
+          POST_VISIT(struct_default_value, schema, field);
+        }
+        POST_VISIT(struct_field_slot, schema, field, slot);
+        break;
+      }
+      case schema::Field::GROUP: {
+        auto group = proto.getGroup();
+        auto groupSchema = get_unbound(group.getTypeId());
+        PRE_VISIT(struct_field_group, schema, field, group, groupSchema);
+        TRAVERSE(annotations, groupSchema);
+        TRAVERSE(struct_fields, groupSchema.asStruct());
+        POST_VISIT(struct_field_group, schema, field, group, groupSchema);
+        break;
+      }
+    }
+    TRAVERSE(annotations, schema, proto.getAnnotations());
+    POST_VISIT(struct_field, schema, field);
+    return false;
+  }
+
+  bool traverse_interface_decl(const Schema& schema, const NestedNode& decl) {
+    auto interface = schema.asInterface();
+    PRE_VISIT(interface_decl, schema, decl);
+    TRAVERSE(nested_decls, schema);
+    if (interested(HOOK_METHODS | METHOD_HOOKS)) {
+      PRE_VISIT(methods, interface);
+      for (const auto& method : interface.getMethods()) {
+        TRAVERSE(method, interface, method);
+      }
+      POST_VISIT(methods, interface);
+    }
+    TRAVERSE(annotations, schema);
+    POST_VISIT(interface_decl, schema, decl);
+    return false;
+  }
+
+  bool traverse_method(const Schema& schema, const InterfaceSchema::Method& method) {
+    if (!interested(METHOD_HOOKS)) return false;
+    const auto& interface = schema.asInterface();
+    const auto& methodProto = method.getProto();
+    auto _ = context_scope(TraversalContext::METHOD, methodProto.getName());
+    PRE_VISIT(method, interface, method);
+    if (methodProto.hasImplicitParameters()) {
+      const auto& implicit = methodProto.getImplicitParameters();
+      PRE_VISIT(method_implicit_params, interface, method, implicit);
+      traverse_params(interface,
+          get_unbound(methodProto.getParamStructType()).asStruct(),
+          get_unbound(methodProto.getResultStructType()).asStruct());
+      POST_VISIT(method_implicit_params, interface, method, implicit);
+    } else {
+      traverse_params(interface, method.getParamType(),
+                      method.getResultType());
+    }
+    TRAVERSE(annotations, schema, methodProto.getAnnotations());
+    POST_VISIT(method, interface, method);
+    return false;
+  }
+
+  void traverse_params(const InterfaceSchema& interface,
+                       const StructSchema& params,
+                       const StructSchema& results) {
+    {
+      auto _ = context_scope(TraversalContext::PARAMS, "parameters");
+      TRAVERSE(param_list, interface, "parameters", params);
+    }
+    auto _ = context_scope(TraversalContext::RESULTS, "results");
+    TRAVERSE(param_list, interface, "results", results);
+  }
+
+  bool traverse_param_list(
+      const InterfaceSchema& interface,
+      const kj::StringPtr& name, const StructSchema& schema) {
+    if (!interested(PARAM_LIST_HOOKS)) return false;
+    PRE_VISIT(param_list, interface, name, schema);
+    TRAVERSE(struct_fields, schema);
+    POST_VISIT(param_list, interface, name, schema);
+    return false;
+  }
+
+  bool traverse_enumerants(const Schema& schema, const EnumSchema::EnumerantList& enumList) {
+    if (!interested(ENUMERANT_HOOKS)) return false;
+    PRE_VISIT(enumerants, schema, enumList);
+    for (const auto& enumerant : enumList) {
+      auto _ = context_scope(TraversalContext::ENUMERANT,
+                             enumerant.getProto().getName());
+      PRE_VISIT(enumerant, schema, enumerant);
+      const auto& proto = enumerant.getProto();
+      TRAVERSE(annotations, schema, proto.getAnnotations());
+      POST_VISIT(enumerant, schema, enumerant);
+    }
+    POST_VISIT(enumerants, schema, enumList);
+    return false;
+  }
+
+  /*[[[cog
+  def output_method(method, args):
+    cog.outl('bool %s(const %s&) { return false; }' % (
+        method, '&, const '.join(args)))
+  for method, args in visit_methods.items():
+    output_method('pre_visit_%s' % method, args)
+  for method, args in visit_methods.items():
+    output_method('post_visit_%s' % method, args)
+  ]]]*/
+  bool pre_visit_file(const Schema&, const schema::CodeGeneratorRequest::RequestedFile::Reader&) { return false; }
+  bool pre_visit_imports(const Schema&, const List<Import>::Reader&) { return false; }
+  bool pre_visit_import(const Schema&, const Import::Reader&) { return false; }
+  bool pre_visit_nested_decls(const Schema&) { return false; }
+  bool pre_visit_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool pre_visit_struct_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool pre_visit_enum_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool pre_visit_const_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool pre_visit_annotation_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool pre_visit_annotation(const schema::Annotation::Reader&, const Schema&) { return false; }
+  bool pre_visit_annotations(const Schema&) { return false; }
+  bool pre_visit_type(const Schema&, const schema::Type::Reader&) { return false; }
+  bool pre_visit_dynamic_value(const Schema&, const Type&, const DynamicValue::Reader&) { return false; }
+  bool pre_visit_struct_fields(const StructSchema&) { return false; }
+  bool pre_visit_struct_default_value(const StructSchema&, const StructSchema::Field&) { return false; }
+  bool pre_visit_struct_field(const StructSchema&, const StructSchema::Field&) { return false; }
+  bool pre_visit_struct_field_slot(const StructSchema&, const StructSchema::Field&, const schema::Field::Slot::Reader&) { return false; }
+  bool pre_visit_struct_field_group(const StructSchema&, const StructSchema::Field&, const schema::Field::Group::Reader&, const Schema&) { return false; }
+  bool pre_visit_struct_field_union(const StructSchema&) { return false; }
+  bool pre_visit_interface_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool pre_visit_param_list(const InterfaceSchema&, const kj::StringPtr&, const StructSchema&) { return false; }
+  bool pre_visit_method(const InterfaceSchema&, const InterfaceSchema::Method&) { return false; }
+  bool pre_visit_methods(const InterfaceSchema&) { return false; }
+  bool pre_visit_method_implicit_params(const InterfaceSchema&, const InterfaceSchema::Method&, const List<schema::Node::Parameter>::Reader&) { return false; }
+  bool pre_visit_enumerant(const Schema&, const EnumSchema::Enumerant&) { return false; }
+  bool pre_visit_enumerants(const Schema&, const EnumSchema::EnumerantList&) { return false; }
+  bool post_visit_file(const Schema&, const schema::CodeGeneratorRequest::RequestedFile::Reader&) { return false; }
+  bool post_visit_imports(const Schema&, const List<Import>::Reader&) { return false; }
+  bool post_visit_import(const Schema&, const Import::Reader&) { return false; }
+  bool post_visit_nested_decls(const Schema&) { return false; }
+  bool post_visit_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool post_visit_struct_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool post_visit_enum_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool post_visit_const_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool post_visit_annotation_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool post_visit_annotation(const schema::Annotation::Reader&, const Schema&) { return false; }
+  bool post_visit_annotations(const Schema&) { return false; }
+  bool post_visit_type(const Schema&, const schema::Type::Reader&) { return false; }
+  bool post_visit_dynamic_value(const Schema&, const Type&, const DynamicValue::Reader&) { return false; }
+  bool post_visit_struct_fields(const StructSchema&) { return false; }
+  bool post_visit_struct_default_value(const StructSchema&, const StructSchema::Field&) { return false; }
+  bool post_visit_struct_field(const StructSchema&, const StructSchema::Field&) { return false; }
+  bool post_visit_struct_field_slot(const StructSchema&, const StructSchema::Field&, const schema::Field::Slot::Reader&) { return false; }
+  bool post_visit_struct_field_group(const StructSchema&, const StructSchema::Field&, const schema::Field::Group::Reader&, const Schema&) { return false; }
+  bool post_visit_struct_field_union(const StructSchema&) { return false; }
+  bool post_visit_interface_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  bool post_visit_param_list(const InterfaceSchema&, const kj::StringPtr&, const StructSchema&) { return false; }
+  bool post_visit_method(const InterfaceSchema&, const InterfaceSchema::Method&) { return false; }
+  bool post_visit_methods(const InterfaceSchema&) { return false; }
+  bool post_visit_method_implicit_params(const InterfaceSchema&, const InterfaceSchema::Method&, const List<schema::Node::Parameter>::Reader&) { return false; }
+  bool post_visit_enumerant(const Schema&, const EnumSchema::Enumerant&) { return false; }
+  bool post_visit_enumerants(const Schema&, const EnumSchema::EnumerantList&) { return false; }
+  //[[[end]]]
+
+  // Typed shortcuts past the DynamicValue hooks, for every scalar value and
+  // every list of primitives the traversal reaches: visit_<type>_value and
+  // visit_<type>_list, one name per type of dodo.py's scalar_types and
+  // primitive_types. Return true to take the value; its
+  // pre/post_visit_dynamic_value (and those of its elements) are then not
+  // called. Defining any of them sets HOOK_TYPED_VALUE in the interest mask.
+  /*[[[cog
+  for name, _, param in scalar_types:
+    cog.outl('bool visit_%s_value(const Schema&, const Type&, const %s&) { return false; }' % (name, param))
+  for name, _, param in primitive_types:
+    cog.outl('bool visit_%s_list(const Schema&, const Type&, const List<%s>::Reader&) { return false; }' % (name, param))
+  ]]]*/
+  bool visit_bool_value(const Schema&, const Type&, const bool&) { return false; }
+  bool visit_int8_value(const Schema&, const Type&, const int8_t&) { return false; }
+  bool visit_int16_value(const Schema&, const Type&, const int16_t&) { return false; }
+  bool visit_int32_value(const Schema&, const Type&, const int32_t&) { return false; }
+  bool visit_int64_value(const Schema&, const Type&, const int64_t&) { return false; }
+  bool visit_uint8_value(const Schema&, const Type&, const uint8_t&) { return false; }
+  bool visit_uint16_value(const Schema&, const Type&, const uint16_t&) { return false; }
+  bool visit_uint32_value(const Schema&, const Type&, const uint32_t&) { return false; }
+  bool visit_uint64_value(const Schema&, const Type&, const uint64_t&) { return false; }
+  bool visit_float32_value(const Schema&, const Type&, const float&) { return false; }
+  bool visit_float64_value(const Schema&, const Type&, const double&) { return false; }
+  bool visit_text_value(const Schema&, const Type&, const Text::Reader&) { return false; }
+  bool visit_data_value(const Schema&, const Type&, const Data::Reader&) { return false; }
+  bool visit_bool_list(const Schema&, const Type&, const List<bool>::Reader&) { return false; }
+  bool visit_int8_list(const Schema&, const Type&, const List<int8_t>::Reader&) { return false; }
+  bool visit_int16_list(const Schema&, const Type&, const List<int16_t>::Reader&) { return false; }
+  bool visit_int32_list(const Schema&, const Type&, const List<int32_t>::Reader&) { return false; }
+  bool visit_int64_list(const Schema&, const Type&, const List<int64_t>::Reader&) { return false; }
+  bool visit_uint8_list(const Schema&, const Type&, const List<uint8_t>::Reader&) { return false; }
+  bool visit_uint16_list(const Schema&, const Type&, const List<uint16_t>::Reader&) { return false; }
+  bool visit_uint32_list(const Schema&, const Type&, const List<uint32_t>::Reader&) { return false; }
+  bool visit_uint64_list(const Schema&, const Type&, const List<uint64_t>::Reader&) { return false; }
+  bool visit_float32_list(const Schema&, const Type&, const List<float>::Reader&) { return false; }
+  bool visit_float64_list(const Schema&, const Type&, const List<double>::Reader&) { return false; }
+  //[[[end]]]
+
+ protected:
+  Derived& self() { return *static_cast<Derived*>(this); }
+};
+
+// The original, virtual flavour: every traverse_* and every hook can be
+// overridden at runtime, at the cost of an indirect call for each of them.
+class BaseGenerator : public StaticGenerator<BaseGenerator> {
+  public:
+   BaseGenerator(SchemaLoader& schemaLoader)
+       : StaticGenerator(schemaLoader) {}
+  virtual ~BaseGenerator() {}
+
+  virtual void finish() {}
+
+  // Every hook can be overridden at runtime, so by default nothing is
+  // pruned. Subclasses can narrow this to the hooks they define.
+  virtual HookMask interest_mask() const { return ALL_HOOKS; }
+
+  using StaticGenerator::traverse_value;
+
+  /*[[[cog
+  for method, args in traverse_methods:
+    cog.outl('virtual bool traverse_%s(%s) {' % (method, ', '.join(
+        'const %s& arg%d' % (arg, i) for i, arg in enumerate(args))))
+    if method == 'param_list':
+      cog.outl('  return traverse_param_list(arg0, legacy_param_list_name(arg1), arg2);')
+    else:
+      cog.outl('  return StaticGenerator::traverse_%s(%s);' % (method, ', '.join(
+          'arg%d' % i for i in range(len(args)))))
+    cog.outl('}')
+  ]]]*/
+  virtual bool traverse_file(const Schema& arg0, const RequestedFile& arg1) {
+    return StaticGenerator::traverse_file(arg0, arg1);
+  }
+  virtual bool traverse_imports(const Schema& arg0, const List<Import>::Reader& arg1) {
+    return StaticGenerator::traverse_imports(arg0, arg1);
+  }
+  virtual bool traverse_nested_decls(const Schema& arg0) {
+    return StaticGenerator::traverse_nested_decls(arg0);
+  }
+  virtual bool traverse_decl(const Schema& arg0, const NestedNode& arg1) {
+    return StaticGenerator::traverse_decl(arg0, arg1);
+  }
+  virtual bool traverse_struct_decl(const Schema& arg0, const NestedNode& arg1) {
+    return StaticGenerator::traverse_struct_decl(arg0, arg1);
+  }
+  virtual bool traverse_enum_decl(const Schema& arg0, const NestedNode& arg1) {
+    return StaticGenerator::traverse_enum_decl(arg0, arg1);
+  }
+  virtual bool traverse_const_decl(const Schema& arg0, const NestedNode& arg1) {
+    return StaticGenerator::traverse_const_decl(arg0, arg1);
+  }
+  virtual bool traverse_annotation_decl(const Schema& arg0, const NestedNode& arg1) {
+    return StaticGenerator::traverse_annotation_decl(arg0, arg1);
+  }
+  virtual bool traverse_annotations(const Schema& arg0) {
+    return StaticGenerator::traverse_annotations(arg0);
+  }
+  virtual bool traverse_annotations(const Schema& arg0, const List<schema::Annotation>::Reader& arg1) {
+    return StaticGenerator::traverse_annotations(arg0, arg1);
+  }
+  virtual bool traverse_annotation(const schema::Annotation::Reader& arg0, const Schema& arg1) {
+    return StaticGenerator::traverse_annotation(arg0, arg1);
+  }
+  virtual bool traverse_type(const Schema& arg0, const schema::Type::Reader& arg1) {
+    return StaticGenerator::traverse_type(arg0, arg1);
+  }
+  virtual bool traverse_dynamic_value(const Schema& arg0, const Type& arg1, const DynamicValue::Reader& arg2) {
+    return StaticGenerator::traverse_dynamic_value(arg0, arg1, arg2);
+  }
+  virtual bool traverse_value(const Schema& arg0, const Type& arg1, const schema::Value::Reader& arg2) {
+    return StaticGenerator::traverse_value(arg0, arg1, arg2);
+  }
+  virtual bool traverse_struct_fields(const StructSchema& arg0) {
+    return StaticGenerator::traverse_struct_fields(arg0);
+  }
+  virtual bool traverse_struct_field(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return StaticGenerator::traverse_struct_field(arg0, arg1);
+  }
+  virtual bool traverse_interface_decl(const Schema& arg0, const NestedNode& arg1) {
+    return StaticGenerator::traverse_interface_decl(arg0, arg1);
+  }
+  virtual bool traverse_method(const Schema& arg0, const InterfaceSchema::Method& arg1) {
+    return StaticGenerator::traverse_method(arg0, arg1);
+  }
+  virtual bool traverse_param_list(const InterfaceSchema& arg0, const kj::StringPtr& arg1, const StructSchema& arg2) {
+    return traverse_param_list(arg0, legacy_param_list_name(arg1), arg2);
+  }
+  virtual bool traverse_enumerants(const Schema& arg0, const EnumSchema::EnumerantList& arg1) {
+    return StaticGenerator::traverse_enumerants(arg0, arg1);
+  }
+  //[[[end]]]
+
+  /*[[[cog
+  def output_method(method, args):
+    if method.endswith('_param_list'):
+      cog.outl('virtual bool %s(const InterfaceSchema& interface, const kj::StringPtr& name, const StructSchema& schema) {' % method)
+      cog.outl('  return %s(interface, legacy_param_list_name(name), schema);' % method)
+      cog.outl('}')
+      return
+    cog.outl('virtual bool %s(const %s&) { return false; }' % (
+        method, '&, const '.join(args)))
+  for method, args in visit_methods.items():
+    output_method('pre_visit_%s' % method, args)
+  for method, args in visit_methods.items():
+    output_method('post_visit_%s' % method, args)
+  ]]]*/
+  virtual bool pre_visit_file(const Schema&, const schema::CodeGeneratorRequest::RequestedFile::Reader&) { return false; }
+  virtual bool pre_visit_imports(const Schema&, const List<Import>::Reader&) { return false; }
+  virtual bool pre_visit_import(const Schema&, const Import::Reader&) { return false; }
+  virtual bool pre_visit_nested_decls(const Schema&) { return false; }
+  virtual bool pre_visit_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool pre_visit_struct_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool pre_visit_enum_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool pre_visit_const_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool pre_visit_annotation_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool pre_visit_annotation(const schema::Annotation::Reader&, const Schema&) { return false; }
+  virtual bool pre_visit_annotations(const Schema&) { return false; }
+  virtual bool pre_visit_type(const Schema&, const schema::Type::Reader&) { return false; }
+  virtual bool pre_visit_dynamic_value(const Schema&, const Type&, const DynamicValue::Reader&) { return false; }
+  virtual bool pre_visit_struct_fields(const StructSchema&) { return false; }
+  virtual bool pre_visit_struct_default_value(const StructSchema&, const StructSchema::Field&) { return false; }
+  virtual bool pre_visit_struct_field(const StructSchema&, const StructSchema::Field&) { return false; }
+  virtual bool pre_visit_struct_field_slot(const StructSchema&, const StructSchema::Field&, const schema::Field::Slot::Reader&) { return false; }
+  virtual bool pre_visit_struct_field_group(const StructSchema&, const StructSchema::Field&, const schema::Field::Group::Reader&, const Schema&) { return false; }
+  virtual bool pre_visit_struct_field_union(const StructSchema&) { return false; }
+  virtual bool pre_visit_interface_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool pre_visit_param_list(const InterfaceSchema& interface, const kj::StringPtr& name, const StructSchema& schema) {
+    return pre_visit_param_list(interface, legacy_param_list_name(name), schema);
+  }
+  virtual bool pre_visit_method(const InterfaceSchema&, const InterfaceSchema::Method&) { return false; }
+  virtual bool pre_visit_methods(const InterfaceSchema&) { return false; }
+  virtual bool pre_visit_method_implicit_params(const InterfaceSchema&, const InterfaceSchema::Method&, const List<schema::Node::Parameter>::Reader&) { return false; }
+  virtual bool pre_visit_enumerant(const Schema&, const EnumSchema::Enumerant&) { return false; }
+  virtual bool pre_visit_enumerants(const Schema&, const EnumSchema::EnumerantList&) { return false; }
+  virtual bool post_visit_file(const Schema&, const schema::CodeGeneratorRequest::RequestedFile::Reader&) { return false; }
+  virtual bool post_visit_imports(const Schema&, const List<Import>::Reader&) { return false; }
+  virtual bool post_visit_import(const Schema&, const Import::Reader&) { return false; }
+  virtual bool post_visit_nested_decls(const Schema&) { return false; }
+  virtual bool post_visit_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool post_visit_struct_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool post_visit_enum_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool post_visit_const_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool post_visit_annotation_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool post_visit_annotation(const schema::Annotation::Reader&, const Schema&) { return false; }
+  virtual bool post_visit_annotations(const Schema&) { return false; }
+  virtual bool post_visit_type(const Schema&, const schema::Type::Reader&) { return false; }
+  virtual bool post_visit_dynamic_value(const Schema&, const Type&, const DynamicValue::Reader&) { return false; }
+  virtual bool post_visit_struct_fields(const StructSchema&) { return false; }
+  virtual bool post_visit_struct_default_value(const StructSchema&, const StructSchema::Field&) { return false; }
+  virtual bool post_visit_struct_field(const StructSchema&, const StructSchema::Field&) { return false; }
+  virtual bool post_visit_struct_field_slot(const StructSchema&, const StructSchema::Field&, const schema::Field::Slot::Reader&) { return false; }
+  virtual bool post_visit_struct_field_group(const StructSchema&, const StructSchema::Field&, const schema::Field::Group::Reader&, const Schema&) { return false; }
+  virtual bool post_visit_struct_field_union(const StructSchema&) { return false; }
+  virtual bool post_visit_interface_decl(const Schema&, const schema::Node::NestedNode::Reader&) { return false; }
+  virtual bool post_visit_param_list(const InterfaceSchema& interface, const kj::StringPtr& name, const StructSchema& schema) {
+    return post_visit_param_list(interface, legacy_param_list_name(name), schema);
+  }
+  virtual bool post_visit_method(const InterfaceSchema&, const InterfaceSchema::Method&) { return false; }
+  virtual bool post_visit_methods(const InterfaceSchema&) { return false; }
+  virtual bool post_visit_method_implicit_params(const InterfaceSchema&, const InterfaceSchema::Method&, const List<schema::Node::Parameter>::Reader&) { return false; }
+  virtual bool post_visit_enumerant(const Schema&, const EnumSchema::Enumerant&) { return false; }
+  virtual bool post_visit_enumerants(const Schema&, const EnumSchema::EnumerantList&) { return false; }
+  //[[[end]]]
+
+  // The param_list name used to be a const kj::String&. Subclasses still
+  // overriding that signature keep being called: the kj::StringPtr versions
+  // above forward to these by default. Deprecated; override the
+  // kj::StringPtr ones instead.
+  virtual bool traverse_param_list(const InterfaceSchema& interface,
+                                   const kj::String& name,
+                                   const StructSchema& schema) {
+    return StaticGenerator::traverse_param_list(interface, name, schema);
+  }
+  virtual bool pre_visit_param_list(const InterfaceSchema&, const kj::String&,
+                                    const StructSchema&) {
+    return false;
+  }
+  virtual bool post_visit_param_list(const InterfaceSchema&, const kj::String&,
+                                     const StructSchema&) {
+    return false;
+  }
+
+  /*[[[cog
+  for name, _, param in scalar_types:
+    cog.outl('virtual bool visit_%s_value(const Schema&, const Type&, const %s&) { return false; }' % (name, param))
+  for name, _, param in primitive_types:
+    cog.outl('virtual bool visit_%s_list(const Schema&, const Type&, const List<%s>::Reader&) { return false; }' % (name, param))
+  ]]]*/
+  virtual bool visit_bool_value(const Schema&, const Type&, const bool&) { return false; }
+  virtual bool visit_int8_value(const Schema&, const Type&, const int8_t&) { return false; }
+  virtual bool visit_int16_value(const Schema&, const Type&, const int16_t&) { return false; }
+  virtual bool visit_int32_value(const Schema&, const Type&, const int32_t&) { return false; }
+  virtual bool visit_int64_value(const Schema&, const Type&, const int64_t&) { return false; }
+  virtual bool visit_uint8_value(const Schema&, const Type&, const uint8_t&) { return false; }
+  virtual bool visit_uint16_value(const Schema&, const Type&, const uint16_t&) { return false; }
+  virtual bool visit_uint32_value(const Schema&, const Type&, const uint32_t&) { return false; }
+  virtual bool visit_uint64_value(const Schema&, const Type&, const uint64_t&) { return false; }
+  virtual bool visit_float32_value(const Schema&, const Type&, const float&) { return false; }
+  virtual bool visit_float64_value(const Schema&, const Type&, const double&) { return false; }
+  virtual bool visit_text_value(const Schema&, const Type&, const Text::Reader&) { return false; }
+  virtual bool visit_data_value(const Schema&, const Type&, const Data::Reader&) { return false; }
+  virtual bool visit_bool_list(const Schema&, const Type&, const List<bool>::Reader&) { return false; }
+  virtual bool visit_int8_list(const Schema&, const Type&, const List<int8_t>::Reader&) { return false; }
+  virtual bool visit_int16_list(const Schema&, const Type&, const List<int16_t>::Reader&) { return false; }
+  virtual bool visit_int32_list(const Schema&, const Type&, const List<int32_t>::Reader&) { return false; }
+  virtual bool visit_int64_list(const Schema&, const Type&, const List<int64_t>::Reader&) { return false; }
+  virtual bool visit_uint8_list(const Schema&, const Type&, const List<uint8_t>::Reader&) { return false; }
+  virtual bool visit_uint16_list(const Schema&, const Type&, const List<uint16_t>::Reader&) { return false; }
+  virtual bool visit_uint32_list(const Schema&, const Type&, const List<uint32_t>::Reader&) { return false; }
+  virtual bool visit_uint64_list(const Schema&, const Type&, const List<uint64_t>::Reader&) { return false; }
+  virtual bool visit_float32_list(const Schema&, const Type&, const List<float>::Reader&) { return false; }
+  virtual bool visit_float64_list(const Schema&, const Type&, const List<double>::Reader&) { return false; }
+  //[[[end]]]
+
+ protected:
+  // The names the traversal passes, as kj::Strings made once.
+  static const kj::String& legacy_param_list_name(kj::StringPtr name) {
+    static const kj::String parameters = kj::heapString("parameters");
+    static const kj::String results = kj::heapString("results");
+    return name == "results" ? results : parameters;
+  }
+};
+
+// Calls, wall time and bytes emitted per hook, as recorded by Profiled.
+// Entry i is pre_visit of the i-th visit method, HOOK_KINDS + i its
+// post_visit.
+class HookProfile {
+ public:
+  struct Entry {
+    uint64_t calls = 0;
+    double totalMs = 0;
+    double maxMs = 0;
+    size_t bytes = 0;
+  };
+
+  /*[[[cog
+  cog.outl('static constexpr unsigned HOOK_KINDS = %d;' % len(visit_methods))
+  ]]]*/
+  static constexpr unsigned HOOK_KINDS = 26;
+  //[[[end]]]
+  // The pre_visit hooks, then the post_visit ones, then the typed ones.
+  static constexpr unsigned VISIT_SCALAR = 2 * HOOK_KINDS;
+  static constexpr unsigned VISIT_PRIMITIVE_LIST = VISIT_SCALAR + 1;
+  static constexpr unsigned SIZE = VISIT_PRIMITIVE_LIST + 1;
+
+  static const char* name(unsigned hook) {
+    static const char* const names[SIZE] = {
+      /*[[[cog
+      for prefix in ('pre', 'post'):
+        for method in visit_methods:
+          cog.outl('"%s_visit_%s",' % (prefix, method))
+      ]]]*/
+      "pre_visit_file",
+      "pre_visit_imports",
+      "pre_visit_import",
+      "pre_visit_nested_decls",
+      "pre_visit_decl",
+      "pre_visit_struct_decl",
+      "pre_visit_enum_decl",
+      "pre_visit_const_decl",
+      "pre_visit_annotation_decl",
+      "pre_visit_annotation",
+      "pre_visit_annotations",
+      "pre_visit_type",
+      "pre_visit_dynamic_value",
+      "pre_visit_struct_fields",
+      "pre_visit_struct_default_value",
+      "pre_visit_struct_field",
+      "pre_visit_struct_field_slot",
+      "pre_visit_struct_field_group",
+      "pre_visit_struct_field_union",
+      "pre_visit_interface_decl",
+      "pre_visit_param_list",
+      "pre_visit_method",
+      "pre_visit_methods",
+      "pre_visit_method_implicit_params",
+      "pre_visit_enumerant",
+      "pre_visit_enumerants",
+      "post_visit_file",
+      "post_visit_imports",
+      "post_visit_import",
+      "post_visit_nested_decls",
+      "post_visit_decl",
+      "post_visit_struct_decl",
+      "post_visit_enum_decl",
+      "post_visit_const_decl",
+      "post_visit_annotation_decl",
+      "post_visit_annotation",
+      "post_visit_annotations",
+      "post_visit_type",
+      "post_visit_dynamic_value",
+      "post_visit_struct_fields",
+      "post_visit_struct_default_value",
+      "post_visit_struct_field",
+      "post_visit_struct_field_slot",
+      "post_visit_struct_field_group",
+      "post_visit_struct_field_union",
+      "post_visit_interface_decl",
+      "post_visit_param_list",
+      "post_visit_method",
+      "post_visit_methods",
+      "post_visit_method_implicit_params",
+      "post_visit_enumerant",
+      "post_visit_enumerants",
+      //[[[end]]]
+      "visit_<type>_value",
+      "visit_<type>_list",
+    };
+    return names[hook];
+  }
+
+  void record(unsigned hook, double ms, size_t bytes) {
+    auto& entry = entries_[hook];
+    entry.calls++;
+    entry.totalMs += ms;
+    entry.maxMs = kj::max(entry.maxMs, ms);
+    entry.bytes += bytes;
+  }
+
+  // Time spent in traverse_file, hooks included.
+  void add_total(double ms) { totalMs_ += ms; }
+
+  HookProfile& operator+=(const HookProfile& other) {
+    for (unsigned i = 0; i < SIZE; ++i) {
+      entries_[i].calls += other.entries_[i].calls;
+      entries_[i].totalMs += other.entries_[i].totalMs;
+      entries_[i].maxMs = kj::max(entries_[i].maxMs, other.entries_[i].maxMs);
+      entries_[i].bytes += other.entries_[i].bytes;
+    }
+    totalMs_ += other.totalMs_;
+    return *this;
+  }
+
+  // The hooks that were called, slowest first, then how much of traverse_file
+  // was spent outside of them, i.e. in the traversal itself.
+  void print(FILE* out) const {
+    fprintf(out, "%-34s %10s %12s %10s %10s %12s\n", "hook", "calls",
+            "total ms", "mean us", "max us", "bytes");
+    for (unsigned hook : sorted()) {
+      const auto& entry = entries_[hook];
+      fprintf(out, "%-34s %10llu %12.3f %10.3f %10.3f %12zu\n", name(hook),
+              (unsigned long long)entry.calls, entry.totalMs,
+              entry.totalMs * 1000 / entry.calls, entry.maxMs * 1000,
+              entry.bytes);
+    }
+    fprintf(out, "%-34s %10s %12.3f\n", "(traversal outside hooks)", "",
+            traversal_ms());
+    fprintf(out, "%-34s %10s %12.3f\n", "(total)", "", totalMs_);
+  }
+
+  void write_json(FILE* out) const {
+    fprintf(out, "{\n  \"total_ms\": %.6f,\n  \"traversal_ms\": %.6f,\n"
+            "  \"hooks\": [", totalMs_, traversal_ms());
+    const char* separator = "\n";
+    for (unsigned hook : sorted()) {
+      const auto& entry = entries_[hook];
+      fprintf(out, "%s    {\"name\": \"%s\", \"calls\": %llu, "
+              "\"total_ms\": %.6f, \"max_ms\": %.6f, \"bytes\": %zu}",
+              separator, name(hook), (unsigned long long)entry.calls,
+              entry.totalMs, entry.maxMs, entry.bytes);
+      separator = ",\n";
+    }
+    fprintf(out, "\n  ]\n}\n");
+  }
+
+ private:
+  Entry entries_[SIZE];
+  double totalMs_ = 0;
+
+  double traversal_ms() const {
+    double hooksMs = 0;
+    for (const auto& entry : entries_) {
+      hooksMs += entry.totalMs;
+    }
+    return totalMs_ - hooksMs;
+  }
+
+  std::vector<unsigned> sorted() const {
+    std::vector<unsigned> hooks;
+    for (unsigned i = 0; i < SIZE; ++i) {
+      if (entries_[i].calls > 0) {
+        hooks.push_back(i);
+      }
+    }
+    std::sort(hooks.begin(), hooks.end(), [this](unsigned a, unsigned b) {
+      return entries_[a].totalMs > entries_[b].totalMs;
+    });
+    return hooks;
+  }
+};
+
+// Wraps any generator, static or virtual, and records a HookProfile of the
+// hooks it defines, timing the ones in Inner's interest mask. CapnpcGenericMain
+// wraps its generator in this with --profile.
+//
+// A BaseGenerator subclass is profiled by deriving from it and overriding its
+// virtual hooks, so its own traverse_* overrides keep running. A
+// StaticGenerator calls its hooks directly, so Profiled runs the traversal
+// itself and forwards every hook to its Inner. That leaves out Inner's
+// traverse_* overrides: SUPPORTED is false then, and --profile is refused.
+template <class Inner, bool = std::is_base_of<BaseGenerator, Inner>::value>
+class Profiled;
+
+template <class Inner>
+class Profiled<Inner, false> : public StaticGenerator<Profiled<Inner>> {
+  typedef StaticGenerator<Profiled<Inner>> Base;
+  typedef schema::CodeGeneratorRequest::RequestedFile::Import Import;
+
+ public:
+  typedef typename Inner::Options Options;
+
+  constexpr static bool SUPPORTED =
+      !Inner::template overrides_traversal<Inner>();
+
+  static void add_options(kj::MainBuilder& builder, Options& options) {
+    Inner::add_options(builder, options);
+  }
+  static kj::String options_key(const Options& options) {
+    return Inner::options_key(options);
+  }
+
+  Profiled(SchemaLoader& schemaLoader, const Options& options)
+      : Profiled(schemaLoader, options,
+                 std::is_constructible<Inner, SchemaLoader&, const Options&>()) {
+  }
+
+  const static auto TRAVERSAL_LIMIT = Inner::TRAVERSAL_LIMIT;
+  constexpr static const char *TITLE = Inner::TITLE;
+  constexpr static const char *DESCRIPTION = Inner::DESCRIPTION;
+  constexpr static bool PARALLEL_SAFE = Inner::PARALLEL_SAFE;
+  constexpr static bool CACHEABLE = Inner::CACHEABLE;
+
+  HookMask interest_mask() const { return mask_; }
+
+  const HookProfile& profile() const { return profile_; }
+
+  SchemaResolver::Stats resolution_stats() const {
+    SchemaResolver::Stats stats = inner_.resolution_stats();
+    stats += Base::resolution_stats();
+    return stats;
+  }
+
+  OutputStats output_stats() const { return inner_.output_stats(); }
+  const std::vector<kj::String>& outputs() const { return inner_.outputs(); }
+  void flush_outputs() { inner_.flush_outputs(); }
+
+  void enter_traverse() { inner_.enter_traverse(); }
+  void leave_traverse(bool guarded) { inner_.leave_traverse(guarded); }
+  void enter_context(TraversalContext::Role role, kj::StringPtr name,
+                     uint32_t index) {
+    inner_.enter_context(role, name, index);
+  }
+  void leave_context() { inner_.leave_context(); }
+
+  /*[[[cog
+  for kind, types, hook, param in (
+      ('value', scalar_types, 'VISIT_SCALAR', '%s'),
+      ('list', primitive_types, 'VISIT_PRIMITIVE_LIST', 'List<%s>::Reader')):
+    for name, _, cpp in types:
+      cog.outl('bool visit_%s_%s(const Schema& schema, const Type& type, const %s& arg) {' % (name, kind, param % cpp))
+      cog.outl('  return record(HookProfile::%s, HOOK_TYPED_VALUE, [&]() {' % hook)
+      cog.outl('    return inner_.visit_%s_%s(schema, type, arg);' % (name, kind))
+      cog.outl('  });')
+      cog.outl('}')
+  ]]]*/
+  bool visit_bool_value(const Schema& schema, const Type& type, const bool& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_bool_value(schema, type, arg);
+    });
+  }
+  bool visit_int8_value(const Schema& schema, const Type& type, const int8_t& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_int8_value(schema, type, arg);
+    });
+  }
+  bool visit_int16_value(const Schema& schema, const Type& type, const int16_t& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_int16_value(schema, type, arg);
+    });
+  }
+  bool visit_int32_value(const Schema& schema, const Type& type, const int32_t& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_int32_value(schema, type, arg);
+    });
+  }
+  bool visit_int64_value(const Schema& schema, const Type& type, const int64_t& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_int64_value(schema, type, arg);
+    });
+  }
+  bool visit_uint8_value(const Schema& schema, const Type& type, const uint8_t& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_uint8_value(schema, type, arg);
+    });
+  }
+  bool visit_uint16_value(const Schema& schema, const Type& type, const uint16_t& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_uint16_value(schema, type, arg);
+    });
+  }
+  bool visit_uint32_value(const Schema& schema, const Type& type, const uint32_t& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_uint32_value(schema, type, arg);
+    });
+  }
+  bool visit_uint64_value(const Schema& schema, const Type& type, const uint64_t& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_uint64_value(schema, type, arg);
+    });
+  }
+  bool visit_float32_value(const Schema& schema, const Type& type, const float& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_float32_value(schema, type, arg);
+    });
+  }
+  bool visit_float64_value(const Schema& schema, const Type& type, const double& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_float64_value(schema, type, arg);
+    });
+  }
+  bool visit_text_value(const Schema& schema, const Type& type, const Text::Reader& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_text_value(schema, type, arg);
+    });
+  }
+  bool visit_data_value(const Schema& schema, const Type& type, const Data::Reader& arg) {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_data_value(schema, type, arg);
+    });
+  }
+  bool visit_bool_list(const Schema& schema, const Type& type, const List<bool>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_bool_list(schema, type, arg);
+    });
+  }
+  bool visit_int8_list(const Schema& schema, const Type& type, const List<int8_t>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_int8_list(schema, type, arg);
+    });
+  }
+  bool visit_int16_list(const Schema& schema, const Type& type, const List<int16_t>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_int16_list(schema, type, arg);
+    });
+  }
+  bool visit_int32_list(const Schema& schema, const Type& type, const List<int32_t>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_int32_list(schema, type, arg);
+    });
+  }
+  bool visit_int64_list(const Schema& schema, const Type& type, const List<int64_t>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_int64_list(schema, type, arg);
+    });
+  }
+  bool visit_uint8_list(const Schema& schema, const Type& type, const List<uint8_t>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_uint8_list(schema, type, arg);
+    });
+  }
+  bool visit_uint16_list(const Schema& schema, const Type& type, const List<uint16_t>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_uint16_list(schema, type, arg);
+    });
+  }
+  bool visit_uint32_list(const Schema& schema, const Type& type, const List<uint32_t>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_uint32_list(schema, type, arg);
+    });
+  }
+  bool visit_uint64_list(const Schema& schema, const Type& type, const List<uint64_t>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_uint64_list(schema, type, arg);
+    });
+  }
+  bool visit_float32_list(const Schema& schema, const Type& type, const List<float>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_float32_list(schema, type, arg);
+    });
+  }
+  bool visit_float64_list(const Schema& schema, const Type& type, const List<double>::Reader& arg) {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return inner_.visit_float64_list(schema, type, arg);
+    });
+  }
+  //[[[end]]]
+
+  bool traverse_file(const Schema& file,
+                     const typename Base::RequestedFile& requestedFile) {
+    inner_.schemaIndex = this->schemaIndex;
+    Stopwatch stopwatch;
+    bool result = Base::traverse_file(file, requestedFile);
+    profile_.add_total(stopwatch.elapsed_ms());
+    return result;
+  }
+
+  void finish() { inner_.finish(); }
+
+  /*[[[cog
+  for i, (method, args) in enumerate(visit_methods.items()):
+    params = ', '.join('const %s& arg%d' % (arg, n) for n, arg in enumerate(args))
+    names = ', '.join('arg%d' % n for n in range(len(args)))
+    for prefix, hook in (('pre', i), ('post', 'HookProfile::HOOK_KINDS + %d' % i)):
+      cog.outl('bool %s_visit_%s(%s) {' % (prefix, method, params))
+      cog.outl('  return record(%s, HOOK_%s, [&]() {' % (hook, method.upper()))
+      cog.outl('    return inner_.%s_visit_%s(%s);' % (prefix, method, names))
+      cog.outl('  });')
+      cog.outl('}')
+  ]]]*/
+  bool pre_visit_file(const Schema& arg0, const schema::CodeGeneratorRequest::RequestedFile::Reader& arg1) {
+    return record(0, HOOK_FILE, [&]() {
+      return inner_.pre_visit_file(arg0, arg1);
+    });
+  }
+  bool post_visit_file(const Schema& arg0, const schema::CodeGeneratorRequest::RequestedFile::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 0, HOOK_FILE, [&]() {
+      return inner_.post_visit_file(arg0, arg1);
+    });
+  }
+  bool pre_visit_imports(const Schema& arg0, const List<Import>::Reader& arg1) {
+    return record(1, HOOK_IMPORTS, [&]() {
+      return inner_.pre_visit_imports(arg0, arg1);
+    });
+  }
+  bool post_visit_imports(const Schema& arg0, const List<Import>::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 1, HOOK_IMPORTS, [&]() {
+      return inner_.post_visit_imports(arg0, arg1);
+    });
+  }
+  bool pre_visit_import(const Schema& arg0, const Import::Reader& arg1) {
+    return record(2, HOOK_IMPORT, [&]() {
+      return inner_.pre_visit_import(arg0, arg1);
+    });
+  }
+  bool post_visit_import(const Schema& arg0, const Import::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 2, HOOK_IMPORT, [&]() {
+      return inner_.post_visit_import(arg0, arg1);
+    });
+  }
+  bool pre_visit_nested_decls(const Schema& arg0) {
+    return record(3, HOOK_NESTED_DECLS, [&]() {
+      return inner_.pre_visit_nested_decls(arg0);
+    });
+  }
+  bool post_visit_nested_decls(const Schema& arg0) {
+    return record(HookProfile::HOOK_KINDS + 3, HOOK_NESTED_DECLS, [&]() {
+      return inner_.post_visit_nested_decls(arg0);
+    });
+  }
+  bool pre_visit_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(4, HOOK_DECL, [&]() {
+      return inner_.pre_visit_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 4, HOOK_DECL, [&]() {
+      return inner_.post_visit_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(5, HOOK_STRUCT_DECL, [&]() {
+      return inner_.pre_visit_struct_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 5, HOOK_STRUCT_DECL, [&]() {
+      return inner_.post_visit_struct_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_enum_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(6, HOOK_ENUM_DECL, [&]() {
+      return inner_.pre_visit_enum_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_enum_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 6, HOOK_ENUM_DECL, [&]() {
+      return inner_.post_visit_enum_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_const_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(7, HOOK_CONST_DECL, [&]() {
+      return inner_.pre_visit_const_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_const_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 7, HOOK_CONST_DECL, [&]() {
+      return inner_.post_visit_const_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotation_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(8, HOOK_ANNOTATION_DECL, [&]() {
+      return inner_.pre_visit_annotation_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_annotation_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 8, HOOK_ANNOTATION_DECL, [&]() {
+      return inner_.post_visit_annotation_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotation(const schema::Annotation::Reader& arg0, const Schema& arg1) {
+    return record(9, HOOK_ANNOTATION, [&]() {
+      return inner_.pre_visit_annotation(arg0, arg1);
+    });
+  }
+  bool post_visit_annotation(const schema::Annotation::Reader& arg0, const Schema& arg1) {
+    return record(HookProfile::HOOK_KINDS + 9, HOOK_ANNOTATION, [&]() {
+      return inner_.post_visit_annotation(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotations(const Schema& arg0) {
+    return record(10, HOOK_ANNOTATIONS, [&]() {
+      return inner_.pre_visit_annotations(arg0);
+    });
+  }
+  bool post_visit_annotations(const Schema& arg0) {
+    return record(HookProfile::HOOK_KINDS + 10, HOOK_ANNOTATIONS, [&]() {
+      return inner_.post_visit_annotations(arg0);
+    });
+  }
+  bool pre_visit_type(const Schema& arg0, const schema::Type::Reader& arg1) {
+    return record(11, HOOK_TYPE, [&]() {
+      return inner_.pre_visit_type(arg0, arg1);
+    });
+  }
+  bool post_visit_type(const Schema& arg0, const schema::Type::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 11, HOOK_TYPE, [&]() {
+      return inner_.post_visit_type(arg0, arg1);
+    });
+  }
+  bool pre_visit_dynamic_value(const Schema& arg0, const Type& arg1, const DynamicValue::Reader& arg2) {
+    return record(12, HOOK_DYNAMIC_VALUE, [&]() {
+      return inner_.pre_visit_dynamic_value(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_dynamic_value(const Schema& arg0, const Type& arg1, const DynamicValue::Reader& arg2) {
+    return record(HookProfile::HOOK_KINDS + 12, HOOK_DYNAMIC_VALUE, [&]() {
+      return inner_.post_visit_dynamic_value(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_struct_fields(const StructSchema& arg0) {
+    return record(13, HOOK_STRUCT_FIELDS, [&]() {
+      return inner_.pre_visit_struct_fields(arg0);
+    });
+  }
+  bool post_visit_struct_fields(const StructSchema& arg0) {
+    return record(HookProfile::HOOK_KINDS + 13, HOOK_STRUCT_FIELDS, [&]() {
+      return inner_.post_visit_struct_fields(arg0);
+    });
+  }
+  bool pre_visit_struct_default_value(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return record(14, HOOK_STRUCT_DEFAULT_VALUE, [&]() {
+      return inner_.pre_visit_struct_default_value(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_default_value(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return record(HookProfile::HOOK_KINDS + 14, HOOK_STRUCT_DEFAULT_VALUE, [&]() {
+      return inner_.post_visit_struct_default_value(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_field(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return record(15, HOOK_STRUCT_FIELD, [&]() {
+      return inner_.pre_visit_struct_field(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_field(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return record(HookProfile::HOOK_KINDS + 15, HOOK_STRUCT_FIELD, [&]() {
+      return inner_.post_visit_struct_field(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_field_slot(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Slot::Reader& arg2) {
+    return record(16, HOOK_STRUCT_FIELD_SLOT, [&]() {
+      return inner_.pre_visit_struct_field_slot(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_struct_field_slot(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Slot::Reader& arg2) {
+    return record(HookProfile::HOOK_KINDS + 16, HOOK_STRUCT_FIELD_SLOT, [&]() {
+      return inner_.post_visit_struct_field_slot(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_struct_field_group(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Group::Reader& arg2, const Schema& arg3) {
+    return record(17, HOOK_STRUCT_FIELD_GROUP, [&]() {
+      return inner_.pre_visit_struct_field_group(arg0, arg1, arg2, arg3);
+    });
+  }
+  bool post_visit_struct_field_group(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Group::Reader& arg2, const Schema& arg3) {
+    return record(HookProfile::HOOK_KINDS + 17, HOOK_STRUCT_FIELD_GROUP, [&]() {
+      return inner_.post_visit_struct_field_group(arg0, arg1, arg2, arg3);
+    });
+  }
+  bool pre_visit_struct_field_union(const StructSchema& arg0) {
+    return record(18, HOOK_STRUCT_FIELD_UNION, [&]() {
+      return inner_.pre_visit_struct_field_union(arg0);
+    });
+  }
+  bool post_visit_struct_field_union(const StructSchema& arg0) {
+    return record(HookProfile::HOOK_KINDS + 18, HOOK_STRUCT_FIELD_UNION, [&]() {
+      return inner_.post_visit_struct_field_union(arg0);
+    });
+  }
+  bool pre_visit_interface_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(19, HOOK_INTERFACE_DECL, [&]() {
+      return inner_.pre_visit_interface_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_interface_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return record(HookProfile::HOOK_KINDS + 19, HOOK_INTERFACE_DECL, [&]() {
+      return inner_.post_visit_interface_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_param_list(const InterfaceSchema& arg0, const kj::StringPtr& arg1, const StructSchema& arg2) {
+    return record(20, HOOK_PARAM_LIST, [&]() {
+      return inner_.pre_visit_param_list(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_param_list(const InterfaceSchema& arg0, const kj::StringPtr& arg1, const StructSchema& arg2) {
+    return record(HookProfile::HOOK_KINDS + 20, HOOK_PARAM_LIST, [&]() {
+      return inner_.post_visit_param_list(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_method(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1) {
+    return record(21, HOOK_METHOD, [&]() {
+      return inner_.pre_visit_method(arg0, arg1);
+    });
+  }
+  bool post_visit_method(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1) {
+    return record(HookProfile::HOOK_KINDS + 21, HOOK_METHOD, [&]() {
+      return inner_.post_visit_method(arg0, arg1);
+    });
+  }
+  bool pre_visit_methods(const InterfaceSchema& arg0) {
+    return record(22, HOOK_METHODS, [&]() {
+      return inner_.pre_visit_methods(arg0);
+    });
+  }
+  bool post_visit_methods(const InterfaceSchema& arg0) {
+    return record(HookProfile::HOOK_KINDS + 22, HOOK_METHODS, [&]() {
+      return inner_.post_visit_methods(arg0);
+    });
+  }
+  bool pre_visit_method_implicit_params(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1, const List<schema::Node::Parameter>::Reader& arg2) {
+    return record(23, HOOK_METHOD_IMPLICIT_PARAMS, [&]() {
+      return inner_.pre_visit_method_implicit_params(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_method_implicit_params(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1, const List<schema::Node::Parameter>::Reader& arg2) {
+    return record(HookProfile::HOOK_KINDS + 23, HOOK_METHOD_IMPLICIT_PARAMS, [&]() {
+      return inner_.post_visit_method_implicit_params(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_enumerant(const Schema& arg0, const EnumSchema::Enumerant& arg1) {
+    return record(24, HOOK_ENUMERANT, [&]() {
+      return inner_.pre_visit_enumerant(arg0, arg1);
+    });
+  }
+  bool post_visit_enumerant(const Schema& arg0, const EnumSchema::Enumerant& arg1) {
+    return record(HookProfile::HOOK_KINDS + 24, HOOK_ENUMERANT, [&]() {
+      return inner_.post_visit_enumerant(arg0, arg1);
+    });
+  }
+  bool pre_visit_enumerants(const Schema& arg0, const EnumSchema::EnumerantList& arg1) {
+    return record(25, HOOK_ENUMERANTS, [&]() {
+      return inner_.pre_visit_enumerants(arg0, arg1);
+    });
+  }
+  bool post_visit_enumerants(const Schema& arg0, const EnumSchema::EnumerantList& arg1) {
+    return record(HookProfile::HOOK_KINDS + 25, HOOK_ENUMERANTS, [&]() {
+      return inner_.post_visit_enumerants(arg0, arg1);
+    });
+  }
+  //[[[end]]]
+
+ private:
+  Inner inner_;
+  HookMask mask_;
+  HookProfile profile_;
+
+  Profiled(SchemaLoader& schemaLoader, const Options& options, std::true_type)
+      : Base(schemaLoader), inner_(schemaLoader, options),
+        mask_(inner_.interest_mask()) {
+  }
+  Profiled(SchemaLoader& schemaLoader, const Options&, std::false_type)
+      : Base(schemaLoader), inner_(schemaLoader),
+        mask_(inner_.interest_mask()) {
+  }
+
+  template <typename Call>
+  bool record(unsigned hook, HookMask bit, const Call& call) {
+    if ((mask_ & bit) == 0) {
+      return call();
+    }
+    size_t bytesBefore = inner_.bytes_emitted();
+    Stopwatch stopwatch;
+    bool result = call();
+    profile_.record(hook, stopwatch.elapsed_ms(),
+                    inner_.bytes_emitted() - bytesBefore);
+    return result;
+  }
+};
+
+template <class Inner>
+class Profiled<Inner, true> : public Inner {
+  typedef schema::CodeGeneratorRequest::RequestedFile::Import Import;
+  typedef schema::CodeGeneratorRequest::RequestedFile::Reader RequestedFile;
+
+ public:
+  typedef typename Inner::Options Options;
+
+  constexpr static bool SUPPORTED = true;
+
+  Profiled(SchemaLoader& schemaLoader, const Options& options)
+      : Profiled(schemaLoader, options,
+                 std::is_constructible<Inner, SchemaLoader&, const Options&>()) {
+  }
+
+  const HookProfile& profile() const { return profile_; }
+
+  bool traverse_file(const Schema& file,
+                     const RequestedFile& requestedFile) override {
+    Stopwatch stopwatch;
+    bool result = Inner::traverse_file(file, requestedFile);
+    profile_.add_total(stopwatch.elapsed_ms());
+    return result;
+  }
+
+  // Only the kj::StringPtr param_list hooks are timed; the deprecated
+  // kj::String ones stay visible rather than hidden.
+  using BaseGenerator::pre_visit_param_list;
+  using BaseGenerator::post_visit_param_list;
+
+  /*[[[cog
+  for i, (method, args) in enumerate(visit_methods.items()):
+    params = ', '.join('const %s& arg%d' % (arg, n) for n, arg in enumerate(args))
+    names = ', '.join('arg%d' % n for n in range(len(args)))
+    for prefix, hook in (('pre', i), ('post', 'HookProfile::HOOK_KINDS + %d' % i)):
+      cog.outl('bool %s_visit_%s(%s) override {' % (prefix, method, params))
+      cog.outl('  return record(%s, HOOK_%s, [&]() {' % (hook, method.upper()))
+      if method == 'param_list':
+        cog.outl('    return Inner::%s_visit_param_list(arg0, param_list_name(' % prefix)
+        cog.outl('        arg1, LEGACY_PARAM_LIST(Inner, %s)), arg2);' % prefix)
+      else:
+        cog.outl('    return Inner::%s_visit_%s(%s);' % (prefix, method, names))
+      cog.outl('  });')
+      cog.outl('}')
+  for kind, types, hook, param in (
+      ('value', scalar_types, 'VISIT_SCALAR', '%s'),
+      ('list', primitive_types, 'VISIT_PRIMITIVE_LIST', 'List<%s>::Reader')):
+    for name, _, cpp in types:
+      cog.outl('bool visit_%s_%s(const Schema& schema, const Type& type, const %s& arg) override {' % (name, kind, param % cpp))
+      cog.outl('  return record(HookProfile::%s, HOOK_TYPED_VALUE, [&]() {' % hook)
+      cog.outl('    return Inner::visit_%s_%s(schema, type, arg);' % (name, kind))
+      cog.outl('  });')
+      cog.outl('}')
+  ]]]*/
+  bool pre_visit_file(const Schema& arg0, const schema::CodeGeneratorRequest::RequestedFile::Reader& arg1) override {
+    return record(0, HOOK_FILE, [&]() {
+      return Inner::pre_visit_file(arg0, arg1);
+    });
+  }
+  bool post_visit_file(const Schema& arg0, const schema::CodeGeneratorRequest::RequestedFile::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 0, HOOK_FILE, [&]() {
+      return Inner::post_visit_file(arg0, arg1);
+    });
+  }
+  bool pre_visit_imports(const Schema& arg0, const List<Import>::Reader& arg1) override {
+    return record(1, HOOK_IMPORTS, [&]() {
+      return Inner::pre_visit_imports(arg0, arg1);
+    });
+  }
+  bool post_visit_imports(const Schema& arg0, const List<Import>::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 1, HOOK_IMPORTS, [&]() {
+      return Inner::post_visit_imports(arg0, arg1);
+    });
+  }
+  bool pre_visit_import(const Schema& arg0, const Import::Reader& arg1) override {
+    return record(2, HOOK_IMPORT, [&]() {
+      return Inner::pre_visit_import(arg0, arg1);
+    });
+  }
+  bool post_visit_import(const Schema& arg0, const Import::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 2, HOOK_IMPORT, [&]() {
+      return Inner::post_visit_import(arg0, arg1);
+    });
+  }
+  bool pre_visit_nested_decls(const Schema& arg0) override {
+    return record(3, HOOK_NESTED_DECLS, [&]() {
+      return Inner::pre_visit_nested_decls(arg0);
+    });
+  }
+  bool post_visit_nested_decls(const Schema& arg0) override {
+    return record(HookProfile::HOOK_KINDS + 3, HOOK_NESTED_DECLS, [&]() {
+      return Inner::post_visit_nested_decls(arg0);
+    });
+  }
+  bool pre_visit_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(4, HOOK_DECL, [&]() {
+      return Inner::pre_visit_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 4, HOOK_DECL, [&]() {
+      return Inner::post_visit_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(5, HOOK_STRUCT_DECL, [&]() {
+      return Inner::pre_visit_struct_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 5, HOOK_STRUCT_DECL, [&]() {
+      return Inner::post_visit_struct_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_enum_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(6, HOOK_ENUM_DECL, [&]() {
+      return Inner::pre_visit_enum_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_enum_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 6, HOOK_ENUM_DECL, [&]() {
+      return Inner::post_visit_enum_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_const_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(7, HOOK_CONST_DECL, [&]() {
+      return Inner::pre_visit_const_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_const_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 7, HOOK_CONST_DECL, [&]() {
+      return Inner::post_visit_const_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotation_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(8, HOOK_ANNOTATION_DECL, [&]() {
+      return Inner::pre_visit_annotation_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_annotation_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 8, HOOK_ANNOTATION_DECL, [&]() {
+      return Inner::post_visit_annotation_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotation(const schema::Annotation::Reader& arg0, const Schema& arg1) override {
+    return record(9, HOOK_ANNOTATION, [&]() {
+      return Inner::pre_visit_annotation(arg0, arg1);
+    });
+  }
+  bool post_visit_annotation(const schema::Annotation::Reader& arg0, const Schema& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 9, HOOK_ANNOTATION, [&]() {
+      return Inner::post_visit_annotation(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotations(const Schema& arg0) override {
+    return record(10, HOOK_ANNOTATIONS, [&]() {
+      return Inner::pre_visit_annotations(arg0);
+    });
+  }
+  bool post_visit_annotations(const Schema& arg0) override {
+    return record(HookProfile::HOOK_KINDS + 10, HOOK_ANNOTATIONS, [&]() {
+      return Inner::post_visit_annotations(arg0);
+    });
+  }
+  bool pre_visit_type(const Schema& arg0, const schema::Type::Reader& arg1) override {
+    return record(11, HOOK_TYPE, [&]() {
+      return Inner::pre_visit_type(arg0, arg1);
+    });
+  }
+  bool post_visit_type(const Schema& arg0, const schema::Type::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 11, HOOK_TYPE, [&]() {
+      return Inner::post_visit_type(arg0, arg1);
+    });
+  }
+  bool pre_visit_dynamic_value(const Schema& arg0, const Type& arg1, const DynamicValue::Reader& arg2) override {
+    return record(12, HOOK_DYNAMIC_VALUE, [&]() {
+      return Inner::pre_visit_dynamic_value(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_dynamic_value(const Schema& arg0, const Type& arg1, const DynamicValue::Reader& arg2) override {
+    return record(HookProfile::HOOK_KINDS + 12, HOOK_DYNAMIC_VALUE, [&]() {
+      return Inner::post_visit_dynamic_value(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_struct_fields(const StructSchema& arg0) override {
+    return record(13, HOOK_STRUCT_FIELDS, [&]() {
+      return Inner::pre_visit_struct_fields(arg0);
+    });
+  }
+  bool post_visit_struct_fields(const StructSchema& arg0) override {
+    return record(HookProfile::HOOK_KINDS + 13, HOOK_STRUCT_FIELDS, [&]() {
+      return Inner::post_visit_struct_fields(arg0);
+    });
+  }
+  bool pre_visit_struct_default_value(const StructSchema& arg0, const StructSchema::Field& arg1) override {
+    return record(14, HOOK_STRUCT_DEFAULT_VALUE, [&]() {
+      return Inner::pre_visit_struct_default_value(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_default_value(const StructSchema& arg0, const StructSchema::Field& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 14, HOOK_STRUCT_DEFAULT_VALUE, [&]() {
+      return Inner::post_visit_struct_default_value(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_field(const StructSchema& arg0, const StructSchema::Field& arg1) override {
+    return record(15, HOOK_STRUCT_FIELD, [&]() {
+      return Inner::pre_visit_struct_field(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_field(const StructSchema& arg0, const StructSchema::Field& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 15, HOOK_STRUCT_FIELD, [&]() {
+      return Inner::post_visit_struct_field(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_field_slot(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Slot::Reader& arg2) override {
+    return record(16, HOOK_STRUCT_FIELD_SLOT, [&]() {
+      return Inner::pre_visit_struct_field_slot(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_struct_field_slot(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Slot::Reader& arg2) override {
+    return record(HookProfile::HOOK_KINDS + 16, HOOK_STRUCT_FIELD_SLOT, [&]() {
+      return Inner::post_visit_struct_field_slot(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_struct_field_group(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Group::Reader& arg2, const Schema& arg3) override {
+    return record(17, HOOK_STRUCT_FIELD_GROUP, [&]() {
+      return Inner::pre_visit_struct_field_group(arg0, arg1, arg2, arg3);
+    });
+  }
+  bool post_visit_struct_field_group(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Group::Reader& arg2, const Schema& arg3) override {
+    return record(HookProfile::HOOK_KINDS + 17, HOOK_STRUCT_FIELD_GROUP, [&]() {
+      return Inner::post_visit_struct_field_group(arg0, arg1, arg2, arg3);
+    });
+  }
+  bool pre_visit_struct_field_union(const StructSchema& arg0) override {
+    return record(18, HOOK_STRUCT_FIELD_UNION, [&]() {
+      return Inner::pre_visit_struct_field_union(arg0);
+    });
+  }
+  bool post_visit_struct_field_union(const StructSchema& arg0) override {
+    return record(HookProfile::HOOK_KINDS + 18, HOOK_STRUCT_FIELD_UNION, [&]() {
+      return Inner::post_visit_struct_field_union(arg0);
+    });
+  }
+  bool pre_visit_interface_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(19, HOOK_INTERFACE_DECL, [&]() {
+      return Inner::pre_visit_interface_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_interface_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 19, HOOK_INTERFACE_DECL, [&]() {
+      return Inner::post_visit_interface_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_param_list(const InterfaceSchema& arg0, const kj::StringPtr& arg1, const StructSchema& arg2) override {
+    return record(20, HOOK_PARAM_LIST, [&]() {
+      return Inner::pre_visit_param_list(arg0, param_list_name(
+          arg1, LEGACY_PARAM_LIST(Inner, pre)), arg2);
+    });
+  }
+  bool post_visit_param_list(const InterfaceSchema& arg0, const kj::StringPtr& arg1, const StructSchema& arg2) override {
+    return record(HookProfile::HOOK_KINDS + 20, HOOK_PARAM_LIST, [&]() {
+      return Inner::post_visit_param_list(arg0, param_list_name(
+          arg1, LEGACY_PARAM_LIST(Inner, post)), arg2);
+    });
+  }
+  bool pre_visit_method(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1) override {
+    return record(21, HOOK_METHOD, [&]() {
+      return Inner::pre_visit_method(arg0, arg1);
+    });
+  }
+  bool post_visit_method(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 21, HOOK_METHOD, [&]() {
+      return Inner::post_visit_method(arg0, arg1);
+    });
+  }
+  bool pre_visit_methods(const InterfaceSchema& arg0) override {
+    return record(22, HOOK_METHODS, [&]() {
+      return Inner::pre_visit_methods(arg0);
+    });
+  }
+  bool post_visit_methods(const InterfaceSchema& arg0) override {
+    return record(HookProfile::HOOK_KINDS + 22, HOOK_METHODS, [&]() {
+      return Inner::post_visit_methods(arg0);
+    });
+  }
+  bool pre_visit_method_implicit_params(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1, const List<schema::Node::Parameter>::Reader& arg2) override {
+    return record(23, HOOK_METHOD_IMPLICIT_PARAMS, [&]() {
+      return Inner::pre_visit_method_implicit_params(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_method_implicit_params(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1, const List<schema::Node::Parameter>::Reader& arg2) override {
+    return record(HookProfile::HOOK_KINDS + 23, HOOK_METHOD_IMPLICIT_PARAMS, [&]() {
+      return Inner::post_visit_method_implicit_params(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_enumerant(const Schema& arg0, const EnumSchema::Enumerant& arg1) override {
+    return record(24, HOOK_ENUMERANT, [&]() {
+      return Inner::pre_visit_enumerant(arg0, arg1);
+    });
+  }
+  bool post_visit_enumerant(const Schema& arg0, const EnumSchema::Enumerant& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 24, HOOK_ENUMERANT, [&]() {
+      return Inner::post_visit_enumerant(arg0, arg1);
+    });
+  }
+  bool pre_visit_enumerants(const Schema& arg0, const EnumSchema::EnumerantList& arg1) override {
+    return record(25, HOOK_ENUMERANTS, [&]() {
+      return Inner::pre_visit_enumerants(arg0, arg1);
+    });
+  }
+  bool post_visit_enumerants(const Schema& arg0, const EnumSchema::EnumerantList& arg1) override {
+    return record(HookProfile::HOOK_KINDS + 25, HOOK_ENUMERANTS, [&]() {
+      return Inner::post_visit_enumerants(arg0, arg1);
+    });
+  }
+  bool visit_bool_value(const Schema& schema, const Type& type, const bool& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_bool_value(schema, type, arg);
+    });
+  }
+  bool visit_int8_value(const Schema& schema, const Type& type, const int8_t& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_int8_value(schema, type, arg);
+    });
+  }
+  bool visit_int16_value(const Schema& schema, const Type& type, const int16_t& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_int16_value(schema, type, arg);
+    });
+  }
+  bool visit_int32_value(const Schema& schema, const Type& type, const int32_t& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_int32_value(schema, type, arg);
+    });
+  }
+  bool visit_int64_value(const Schema& schema, const Type& type, const int64_t& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_int64_value(schema, type, arg);
+    });
+  }
+  bool visit_uint8_value(const Schema& schema, const Type& type, const uint8_t& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_uint8_value(schema, type, arg);
+    });
+  }
+  bool visit_uint16_value(const Schema& schema, const Type& type, const uint16_t& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_uint16_value(schema, type, arg);
+    });
+  }
+  bool visit_uint32_value(const Schema& schema, const Type& type, const uint32_t& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_uint32_value(schema, type, arg);
+    });
+  }
+  bool visit_uint64_value(const Schema& schema, const Type& type, const uint64_t& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_uint64_value(schema, type, arg);
+    });
+  }
+  bool visit_float32_value(const Schema& schema, const Type& type, const float& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_float32_value(schema, type, arg);
+    });
+  }
+  bool visit_float64_value(const Schema& schema, const Type& type, const double& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_float64_value(schema, type, arg);
+    });
+  }
+  bool visit_text_value(const Schema& schema, const Type& type, const Text::Reader& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_text_value(schema, type, arg);
+    });
+  }
+  bool visit_data_value(const Schema& schema, const Type& type, const Data::Reader& arg) override {
+    return record(HookProfile::VISIT_SCALAR, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_data_value(schema, type, arg);
+    });
+  }
+  bool visit_bool_list(const Schema& schema, const Type& type, const List<bool>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_bool_list(schema, type, arg);
+    });
+  }
+  bool visit_int8_list(const Schema& schema, const Type& type, const List<int8_t>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_int8_list(schema, type, arg);
+    });
+  }
+  bool visit_int16_list(const Schema& schema, const Type& type, const List<int16_t>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_int16_list(schema, type, arg);
+    });
+  }
+  bool visit_int32_list(const Schema& schema, const Type& type, const List<int32_t>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_int32_list(schema, type, arg);
+    });
+  }
+  bool visit_int64_list(const Schema& schema, const Type& type, const List<int64_t>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_int64_list(schema, type, arg);
+    });
+  }
+  bool visit_uint8_list(const Schema& schema, const Type& type, const List<uint8_t>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_uint8_list(schema, type, arg);
+    });
+  }
+  bool visit_uint16_list(const Schema& schema, const Type& type, const List<uint16_t>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_uint16_list(schema, type, arg);
+    });
+  }
+  bool visit_uint32_list(const Schema& schema, const Type& type, const List<uint32_t>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_uint32_list(schema, type, arg);
+    });
+  }
+  bool visit_uint64_list(const Schema& schema, const Type& type, const List<uint64_t>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_uint64_list(schema, type, arg);
+    });
+  }
+  bool visit_float32_list(const Schema& schema, const Type& type, const List<float>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_float32_list(schema, type, arg);
+    });
+  }
+  bool visit_float64_list(const Schema& schema, const Type& type, const List<double>::Reader& arg) override {
+    return record(HookProfile::VISIT_PRIMITIVE_LIST, HOOK_TYPED_VALUE, [&]() {
+      return Inner::visit_float64_list(schema, type, arg);
+    });
+  }
+  //[[[end]]]
+
+ private:
+  HookMask mask_;
+  HookProfile profile_;
+
+  Profiled(SchemaLoader& schemaLoader, const Options& options, std::true_type)
+      : Inner(schemaLoader, options), mask_(this->interest_mask()) {
+  }
+  Profiled(SchemaLoader& schemaLoader, const Options&, std::false_type)
+      : Inner(schemaLoader), mask_(this->interest_mask()) {
+  }
+
+  // Inner's param_list hooks may still take the name as a kj::String.
+  static const kj::StringPtr& param_list_name(const kj::StringPtr& name,
+                                              std::false_type) {
+    return name;
+  }
+  static const kj::String& param_list_name(const kj::StringPtr& name,
+                                           std::true_type) {
+    return BaseGenerator::legacy_param_list_name(name);
+  }
+
+  template <typename Call>
+  bool record(unsigned hook, HookMask bit, const Call& call) {
+    if ((mask_ & bit) == 0) {
+      return call();
+    }
+    size_t bytesBefore = this->bytes_emitted();
+    Stopwatch stopwatch;
+    bool result = call();
+    profile_.record(hook, stopwatch.elapsed_ms(),
+                    this->bytes_emitted() - bytesBefore);
+    return result;
+  }
+};
+
+// A new G, passed its options when its constructor takes them.
+template <class G>
+kj::Own<G> make_generator(SchemaLoader& schemaLoader,
+                          const typename G::Options& options, std::true_type) {
+  return kj::heap<G>(schemaLoader, options);
+}
+template <class G>
+kj::Own<G> make_generator(SchemaLoader& schemaLoader,
+                          const typename G::Options&, std::false_type) {
+  return kj::heap<G>(schemaLoader);
+}
+template <class G>
+kj::Own<G> make_generator(SchemaLoader& schemaLoader,
+                          const typename G::Options& options) {
+  return make_generator<G>(schemaLoader, options, std::is_constructible<
+      G, SchemaLoader&, const typename G::Options&>());
+}
+
+constexpr bool all_of(std::initializer_list<bool> values) {
+  for (bool value : values) {
+    if (!value) return false;
+  }
+  return true;
+}
+
+// Drives several generators, static or virtual, from one traversal:
+// CapnpcGenericMain<Multi<A, B, C>> reads and loads the request once and
+// walks each file once, calling every hook on A, B and C in turn.
+//
+// A child whose hook returns true skips exactly what it would have skipped on
+// its own: the rest of the traverse_* call the hook ran in, and the caller's
+// as well where that one GUARD_FALSEs the result. The other children carry on;
+// the shared traversal only skips when all of them do. Their options are all
+// registered on the same command line and must not clash.
+//
+// Multi runs the traversal itself, so the children's traverse_* methods are
+// not used. A static child that overrides any of them does not compile. A
+// BaseGenerator child's overrides can't be seen at compile time: they are
+// silently skipped, and such a child may generate differently than on its
+// own.
+template <class... Children>
+class Multi : public StaticGenerator<Multi<Children...>> {
+  typedef StaticGenerator<Multi<Children...>> Base;
+  typedef schema::CodeGeneratorRequest::RequestedFile::Import Import;
+  typedef std::index_sequence_for<Children...> Indices;
+  constexpr static size_t SIZE = sizeof...(Children);
+
+  static_assert(
+      all_of({(std::is_base_of<BaseGenerator, Children>::value ||
+               !Children::template overrides_traversal<Children>())...}),
+      "Multi does not run the traverse_* overrides of its children");
+
+ public:
+  typedef std::tuple<typename Children::Options...> Options;
+
+  static void add_options(kj::MainBuilder& builder, Options& options) {
+    add_options(builder, options, Indices());
+  }
+  static kj::String options_key(const Options& options) {
+    return options_key(options, Indices());
+  }
+
+  Multi(SchemaLoader& schemaLoader, const Options& options)
+      : Multi(schemaLoader, options, Indices()) {}
+
+  constexpr static uint64_t TRAVERSAL_LIMIT =
+      std::max({uint64_t(Children::TRAVERSAL_LIMIT)...});
+  constexpr static const char *TITLE = "Multiple generators";
+  constexpr static const char *DESCRIPTION =
+      "Runs several generators over one traversal of the request.";
+  constexpr static bool PARALLEL_SAFE = all_of({Children::PARALLEL_SAFE...});
+  constexpr static bool CACHEABLE = all_of({Children::CACHEABLE...});
+
+  HookMask interest_mask() const { return mask_; }
+
+  SchemaResolver::Stats resolution_stats() const {
+    SchemaResolver::Stats stats = Base::resolution_stats();
+    for_each([&](const auto& child) { stats += child.resolution_stats(); });
+    return stats;
+  }
+
+  OutputStats output_stats() const {
+    OutputStats stats;
+    for_each([&](const auto& child) { stats += child.output_stats(); });
+    return stats;
+  }
+
+  // The children's outputs, each batch appended as it is asked for, so that
+  // the outputs of one file stay together.
+  const std::vector<kj::String>& outputs() const {
+    size_t i = 0;
+    for_each([&](const auto& child) {
+      const auto& outputs = child.outputs();
+      for (; synced_[i] < outputs.size(); synced_[i]++) {
+        outputs_.push_back(kj::heapString(outputs[synced_[i]]));
+      }
+      i++;
+    });
+    return outputs_;
+  }
+
+  size_t bytes_emitted() const {
+    size_t bytes = 0;
+    for_each([&](const auto& child) { bytes += child.bytes_emitted(); });
+    return bytes;
+  }
+
+  void flush_outputs() {
+    for_each([](auto& child) { child.flush_outputs(); });
+  }
+
+  void enter_context(TraversalContext::Role role, kj::StringPtr name,
+                     uint32_t index) {
+    for_each([&](auto& child) { child.enter_context(role, name, index); });
+  }
+  void leave_context() {
+    for_each([](auto& child) { child.leave_context(); });
+  }
+
+  void finish() {
+    for_each([](auto& child) { child.finish(); });
+  }
+
+  // Only offered to the children that define typed hooks.
+  /*[[[cog
+  for kind, types, param in (('value', scalar_types, '%s'),
+                             ('list', primitive_types, 'List<%s>::Reader')):
+    for name, _, cpp in types:
+      cog.outl('bool visit_%s_%s(const Schema& schema, const Type& type, const %s& arg) {' % (name, kind, param % cpp))
+      cog.outl('  return visit([&](auto& child) {')
+      cog.outl('    return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&')
+      cog.outl('           child.visit_%s_%s(schema, type, arg);' % (name, kind))
+      cog.outl('  });')
+      cog.outl('}')
+  ]]]*/
+  bool visit_bool_value(const Schema& schema, const Type& type, const bool& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_bool_value(schema, type, arg);
+    });
+  }
+  bool visit_int8_value(const Schema& schema, const Type& type, const int8_t& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_int8_value(schema, type, arg);
+    });
+  }
+  bool visit_int16_value(const Schema& schema, const Type& type, const int16_t& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_int16_value(schema, type, arg);
+    });
+  }
+  bool visit_int32_value(const Schema& schema, const Type& type, const int32_t& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_int32_value(schema, type, arg);
+    });
+  }
+  bool visit_int64_value(const Schema& schema, const Type& type, const int64_t& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_int64_value(schema, type, arg);
+    });
+  }
+  bool visit_uint8_value(const Schema& schema, const Type& type, const uint8_t& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_uint8_value(schema, type, arg);
+    });
+  }
+  bool visit_uint16_value(const Schema& schema, const Type& type, const uint16_t& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_uint16_value(schema, type, arg);
+    });
+  }
+  bool visit_uint32_value(const Schema& schema, const Type& type, const uint32_t& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_uint32_value(schema, type, arg);
+    });
+  }
+  bool visit_uint64_value(const Schema& schema, const Type& type, const uint64_t& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_uint64_value(schema, type, arg);
+    });
+  }
+  bool visit_float32_value(const Schema& schema, const Type& type, const float& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_float32_value(schema, type, arg);
+    });
+  }
+  bool visit_float64_value(const Schema& schema, const Type& type, const double& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_float64_value(schema, type, arg);
+    });
+  }
+  bool visit_text_value(const Schema& schema, const Type& type, const Text::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_text_value(schema, type, arg);
+    });
+  }
+  bool visit_data_value(const Schema& schema, const Type& type, const Data::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_data_value(schema, type, arg);
+    });
+  }
+  bool visit_bool_list(const Schema& schema, const Type& type, const List<bool>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_bool_list(schema, type, arg);
+    });
+  }
+  bool visit_int8_list(const Schema& schema, const Type& type, const List<int8_t>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_int8_list(schema, type, arg);
+    });
+  }
+  bool visit_int16_list(const Schema& schema, const Type& type, const List<int16_t>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_int16_list(schema, type, arg);
+    });
+  }
+  bool visit_int32_list(const Schema& schema, const Type& type, const List<int32_t>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_int32_list(schema, type, arg);
+    });
+  }
+  bool visit_int64_list(const Schema& schema, const Type& type, const List<int64_t>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_int64_list(schema, type, arg);
+    });
+  }
+  bool visit_uint8_list(const Schema& schema, const Type& type, const List<uint8_t>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_uint8_list(schema, type, arg);
+    });
+  }
+  bool visit_uint16_list(const Schema& schema, const Type& type, const List<uint16_t>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_uint16_list(schema, type, arg);
+    });
+  }
+  bool visit_uint32_list(const Schema& schema, const Type& type, const List<uint32_t>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_uint32_list(schema, type, arg);
+    });
+  }
+  bool visit_uint64_list(const Schema& schema, const Type& type, const List<uint64_t>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_uint64_list(schema, type, arg);
+    });
+  }
+  bool visit_float32_list(const Schema& schema, const Type& type, const List<float>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_float32_list(schema, type, arg);
+    });
+  }
+  bool visit_float64_list(const Schema& schema, const Type& type, const List<double>::Reader& arg) {
+    return visit([&](auto& child) {
+      return (child.interest_mask() & HOOK_TYPED_VALUE) != 0 &&
+             child.visit_float64_list(schema, type, arg);
+    });
+  }
+  //[[[end]]]
+
+  void enter_traverse() { depth_++; }
+  void leave_traverse(bool guarded) {
+    for (auto& depth : skippedAt_) {
+      if (depth >= depth_) depth = guarded ? depth_ - 1 : 0;
+    }
+    depth_--;
+  }
+
+  /*[[[cog
+  for method, args in visit_methods.items():
+    params = ', '.join('const %s& arg%d' % (arg, n) for n, arg in enumerate(args))
+    names = ', '.join('arg%d' % n for n in range(len(args)))
+    for prefix in ('pre', 'post'):
+      cog.outl('bool %s_visit_%s(%s) {' % (prefix, method, params))
+      if (prefix, method) == ('pre', 'file'):
+        cog.outl('  start_file();')
+      cog.outl('  return visit([&](auto& child) {')
+      cog.outl('    return child.%s_visit_%s(%s);' % (prefix, method, names))
+      cog.outl('  });')
+      cog.outl('}')
+  ]]]*/
+  bool pre_visit_file(const Schema& arg0, const schema::CodeGeneratorRequest::RequestedFile::Reader& arg1) {
+    start_file();
+    return visit([&](auto& child) {
+      return child.pre_visit_file(arg0, arg1);
+    });
+  }
+  bool post_visit_file(const Schema& arg0, const schema::CodeGeneratorRequest::RequestedFile::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_file(arg0, arg1);
+    });
+  }
+  bool pre_visit_imports(const Schema& arg0, const List<Import>::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_imports(arg0, arg1);
+    });
+  }
+  bool post_visit_imports(const Schema& arg0, const List<Import>::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_imports(arg0, arg1);
+    });
+  }
+  bool pre_visit_import(const Schema& arg0, const Import::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_import(arg0, arg1);
+    });
+  }
+  bool post_visit_import(const Schema& arg0, const Import::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_import(arg0, arg1);
+    });
+  }
+  bool pre_visit_nested_decls(const Schema& arg0) {
+    return visit([&](auto& child) {
+      return child.pre_visit_nested_decls(arg0);
+    });
+  }
+  bool post_visit_nested_decls(const Schema& arg0) {
+    return visit([&](auto& child) {
+      return child.post_visit_nested_decls(arg0);
+    });
+  }
+  bool pre_visit_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_struct_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_struct_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_enum_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_enum_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_enum_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_enum_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_const_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_const_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_const_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_const_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotation_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_annotation_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_annotation_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_annotation_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotation(const schema::Annotation::Reader& arg0, const Schema& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_annotation(arg0, arg1);
+    });
+  }
+  bool post_visit_annotation(const schema::Annotation::Reader& arg0, const Schema& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_annotation(arg0, arg1);
+    });
+  }
+  bool pre_visit_annotations(const Schema& arg0) {
+    return visit([&](auto& child) {
+      return child.pre_visit_annotations(arg0);
+    });
+  }
+  bool post_visit_annotations(const Schema& arg0) {
+    return visit([&](auto& child) {
+      return child.post_visit_annotations(arg0);
+    });
+  }
+  bool pre_visit_type(const Schema& arg0, const schema::Type::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_type(arg0, arg1);
+    });
+  }
+  bool post_visit_type(const Schema& arg0, const schema::Type::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_type(arg0, arg1);
+    });
+  }
+  bool pre_visit_dynamic_value(const Schema& arg0, const Type& arg1, const DynamicValue::Reader& arg2) {
+    return visit([&](auto& child) {
+      return child.pre_visit_dynamic_value(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_dynamic_value(const Schema& arg0, const Type& arg1, const DynamicValue::Reader& arg2) {
+    return visit([&](auto& child) {
+      return child.post_visit_dynamic_value(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_struct_fields(const StructSchema& arg0) {
+    return visit([&](auto& child) {
+      return child.pre_visit_struct_fields(arg0);
+    });
+  }
+  bool post_visit_struct_fields(const StructSchema& arg0) {
+    return visit([&](auto& child) {
+      return child.post_visit_struct_fields(arg0);
+    });
+  }
+  bool pre_visit_struct_default_value(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_struct_default_value(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_default_value(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_struct_default_value(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_field(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_struct_field(arg0, arg1);
+    });
+  }
+  bool post_visit_struct_field(const StructSchema& arg0, const StructSchema::Field& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_struct_field(arg0, arg1);
+    });
+  }
+  bool pre_visit_struct_field_slot(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Slot::Reader& arg2) {
+    return visit([&](auto& child) {
+      return child.pre_visit_struct_field_slot(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_struct_field_slot(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Slot::Reader& arg2) {
+    return visit([&](auto& child) {
+      return child.post_visit_struct_field_slot(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_struct_field_group(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Group::Reader& arg2, const Schema& arg3) {
+    return visit([&](auto& child) {
+      return child.pre_visit_struct_field_group(arg0, arg1, arg2, arg3);
+    });
+  }
+  bool post_visit_struct_field_group(const StructSchema& arg0, const StructSchema::Field& arg1, const schema::Field::Group::Reader& arg2, const Schema& arg3) {
+    return visit([&](auto& child) {
+      return child.post_visit_struct_field_group(arg0, arg1, arg2, arg3);
+    });
+  }
+  bool pre_visit_struct_field_union(const StructSchema& arg0) {
+    return visit([&](auto& child) {
+      return child.pre_visit_struct_field_union(arg0);
+    });
+  }
+  bool post_visit_struct_field_union(const StructSchema& arg0) {
+    return visit([&](auto& child) {
+      return child.post_visit_struct_field_union(arg0);
+    });
+  }
+  bool pre_visit_interface_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_interface_decl(arg0, arg1);
+    });
+  }
+  bool post_visit_interface_decl(const Schema& arg0, const schema::Node::NestedNode::Reader& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_interface_decl(arg0, arg1);
+    });
+  }
+  bool pre_visit_param_list(const InterfaceSchema& arg0, const kj::StringPtr& arg1, const StructSchema& arg2) {
+    return visit([&](auto& child) {
+      return child.pre_visit_param_list(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_param_list(const InterfaceSchema& arg0, const kj::StringPtr& arg1, const StructSchema& arg2) {
+    return visit([&](auto& child) {
+      return child.post_visit_param_list(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_method(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_method(arg0, arg1);
+    });
+  }
+  bool post_visit_method(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_method(arg0, arg1);
+    });
+  }
+  bool pre_visit_methods(const InterfaceSchema& arg0) {
+    return visit([&](auto& child) {
+      return child.pre_visit_methods(arg0);
+    });
+  }
+  bool post_visit_methods(const InterfaceSchema& arg0) {
+    return visit([&](auto& child) {
+      return child.post_visit_methods(arg0);
+    });
+  }
+  bool pre_visit_method_implicit_params(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1, const List<schema::Node::Parameter>::Reader& arg2) {
+    return visit([&](auto& child) {
+      return child.pre_visit_method_implicit_params(arg0, arg1, arg2);
+    });
+  }
+  bool post_visit_method_implicit_params(const InterfaceSchema& arg0, const InterfaceSchema::Method& arg1, const List<schema::Node::Parameter>::Reader& arg2) {
+    return visit([&](auto& child) {
+      return child.post_visit_method_implicit_params(arg0, arg1, arg2);
+    });
+  }
+  bool pre_visit_enumerant(const Schema& arg0, const EnumSchema::Enumerant& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_enumerant(arg0, arg1);
+    });
+  }
+  bool post_visit_enumerant(const Schema& arg0, const EnumSchema::Enumerant& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_enumerant(arg0, arg1);
+    });
+  }
+  bool pre_visit_enumerants(const Schema& arg0, const EnumSchema::EnumerantList& arg1) {
+    return visit([&](auto& child) {
+      return child.pre_visit_enumerants(arg0, arg1);
+    });
+  }
+  bool post_visit_enumerants(const Schema& arg0, const EnumSchema::EnumerantList& arg1) {
+    return visit([&](auto& child) {
+      return child.post_visit_enumerants(arg0, arg1);
+    });
+  }
   //[[[end]]]
-};
 
+ private:
+  std::tuple<kj::Own<Children>...> children_;
+  HookMask mask_ = 0;
+  // Traversal frames entered in the current file, counting traverse_file.
+  unsigned depth_ = 1;
+  // For each child, the frame whose remainder it skips, or 0.
+  std::array<unsigned, SIZE> skippedAt_ = {};
+  mutable std::vector<kj::String> outputs_;
+  mutable std::array<size_t, SIZE> synced_ = {};
+
+  template <size_t... I>
+  Multi(SchemaLoader& schemaLoader, const Options& options,
+        std::index_sequence<I...>)
+      : Base(schemaLoader),
+        children_(make_generator<Children>(
+            schemaLoader, std::get<I>(options))...) {
+    for_each([&](const auto& child) { mask_ |= child.interest_mask(); });
+  }
+
+  template <size_t... I>
+  static void add_options(kj::MainBuilder& builder, Options& options,
+                          std::index_sequence<I...>) {
+    (void)std::initializer_list<int>{
+        (Children::add_options(builder, std::get<I>(options)), 0)...};
+  }
+  template <size_t... I>
+  static kj::String options_key(const Options& options,
+                                std::index_sequence<I...>) {
+    return kj::str(
+        kj::str(Children::options_key(std::get<I>(options)), '\n')...);
+  }
+
+  template <typename Call>
+  void for_each(const Call& call) {
+    for_each(call, Indices());
+  }
+  template <typename Call, size_t... I>
+  void for_each(const Call& call, std::index_sequence<I...>) {
+    (void)std::initializer_list<int>{(call(*std::get<I>(children_)), 0)...};
+  }
+  template <typename Call>
+  void for_each(const Call& call) const {
+    for_each(call, Indices());
+  }
+  template <typename Call, size_t... I>
+  void for_each(const Call& call, std::index_sequence<I...>) const {
+    (void)std::initializer_list<int>{(call(*std::get<I>(children_)), 0)...};
+  }
+
+  void start_file() {
+    depth_ = 1;
+    skippedAt_.fill(0);
+    for_each([&](auto& child) { child.schemaIndex = this->schemaIndex; });
+  }
+
+  // Calls the hook on every child that is not skipping, in order. True when
+  // all of them now skip, so that the traversal can too.
+  template <typename Call>
+  bool visit(const Call& call) {
+    return visit(call, Indices());
+  }
+  template <typename Call, size_t... I>
+  bool visit(const Call& call, std::index_sequence<I...>) {
+    bool skip = true;
+    (void)std::initializer_list<int>{
+        (skip = visit_child<I>(call) && skip, 0)...};
+    return skip;
+  }
+  template <size_t I, typename Call>
+  bool visit_child(const Call& call) {
+    if (skippedAt_[I] == 0 && call(*std::get<I>(children_))) {
+      skippedAt_[I] = depth_;
+    }
+    return skippedAt_[I] != 0;
+  }
+};
 
 #ifndef VERSION
 #define VERSION "(unknown)"
 #endif
 
+#include <errno.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <atomic>
+#include <climits>
+#include <unordered_set>
 #if USE_DEATH_HANDLER
 #include "death_handler.h"
 #endif
 
+// A read-only mapping of a whole file, so a request can be read in place.
+class MappedFile {
+ public:
+  MappedFile(void* data, size_t size) : data_(data), size_(size) {}
+  ~MappedFile() { munmap(data_, size_); }
+  kj::ArrayPtr<const word> words() const {
+    return kj::arrayPtr(reinterpret_cast<const word*>(data_),
+                        size_ / sizeof(word));
+  }
+ private:
+  void* data_;
+  size_t size_;
+};
+
+// Feeds a lazy SchemaLoader from an id->node index over the request, so only
+// the nodes the traversal actually reaches (and their dependencies) are ever
+// validated and copied into the loader.
+class RequestNodeLoader : public SchemaLoader::LazyLoadCallback {
+ public:
+  RequestNodeLoader(const List<schema::Node>::Reader& nodes) {
+    index_.reserve(nodes.size());
+    for (const auto& node : nodes) {
+      index_.emplace(std::piecewise_construct,
+                     std::forward_as_tuple(node.getId()),
+                     std::forward_as_tuple(node));
+    }
+  }
+
+  void load(const SchemaLoader& loader, uint64_t id) const override {
+    auto iter = index_.find(id);
+    if (iter == index_.end()) return;
+    if (!iter->second.loaded.exchange(true)) {
+      ++loaded_;
+    }
+    loader.loadOnce(iter->second.node);
+  }
+
+  // How many nodes have been materialized so far.
+  size_t loaded() const { return loaded_; }
+
+ private:
+  struct Entry {
+    Entry(const schema::Node::Reader& node) : node(node), loaded(false) {}
+    schema::Node::Reader node;
+    mutable std::atomic<bool> loaded;
+  };
+  std::unordered_map<uint64_t, Entry> index_;
+  mutable std::atomic<size_t> loaded_{0};
+};
+
+// 64-bit FNV-1a over the bytes, for cache keys and node comparisons.
+inline uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+  const kj::byte* bytes = static_cast<const kj::byte*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+constexpr uint64_t HASH_SEED = 14695981039346656037ull;
+
+// A hash of a struct's content, independent of where it sits in its message:
+// copying it lays it out the same way every time.
+template <typename Reader>
+uint64_t content_hash(const Reader& reader) {
+  MallocMessageBuilder copy(reader.totalSize().wordCount + 1);
+  copy.setRoot(reader);
+  uint64_t hash = HASH_SEED;
+  for (const auto& segment : copy.getSegmentsForOutput()) {
+    auto bytes = segment.asBytes();
+    hash = hash_bytes(hash, bytes.begin(), bytes.size());
+  }
+  return hash;
+}
+
+// Backs --cache-dir. A requested file's key covers its transitive closure of
+// nodes (nested declarations and every type, brand and annotation they
+// refer to), the RequestedFile itself and a salt for the generator, its
+// options and the output directory. Under <dir>/<key> goes a stamp listing
+// the outputs generated for it; while they are still as they were then, the
+// file does not need to be generated again.
+class GenerationCache {
+ public:
+  typedef schema::CodeGeneratorRequest::RequestedFile RequestedFile;
+
+  GenerationCache(kj::StringPtr dir, uint64_t salt,
+                  const List<schema::Node>::Reader& nodes)
+      : dir_(kj::heapString(dir)), salt_(salt) {
+    nodes_.reserve(nodes.size());
+    for (const auto& node : nodes) {
+      nodes_.emplace(node.getId(), node);
+    }
+  }
+
+  uint64_t key(const RequestedFile::Reader& requestedFile) {
+    std::vector<uint64_t> closure;
+    pending_.push_back(requestedFile.getId());
+    seen_.clear();
+    seen_.insert(requestedFile.getId());
+    while (!pending_.empty()) {
+      uint64_t id = pending_.back();
+      pending_.pop_back();
+      auto found = nodes_.find(id);
+      if (found != nodes_.end()) {
+        closure.push_back(id);
+        add_node(found->second);
+      }
+    }
+    std::sort(closure.begin(), closure.end());
+
+    uint64_t hash = salt_;
+    uint64_t fileHash = content_hash(requestedFile);
+    hash = hash_bytes(hash, &fileHash, sizeof(fileHash));
+    for (uint64_t id : closure) {
+      auto memo = hashes_.find(id);
+      if (memo == hashes_.end()) {
+        memo = hashes_.emplace(id, content_hash(nodes_.find(id)->second)).first;
+      }
+      hash = hash_bytes(hash, &id, sizeof(id));
+      hash = hash_bytes(hash, &memo->second, sizeof(memo->second));
+    }
+    return hash;
+  }
+
+  // Whether the outputs stamped for key are all still there, untouched.
+  bool fresh(uint64_t key) const {
+    FILE* stamp = fopen(stamp_path(key).cStr(), "r");
+    if (stamp == nullptr) {
+      return false;
+    }
+    auto _ = Finally([&](){ fclose(stamp); });
+    char line[4096];
+    while (fgets(line, sizeof(line), stamp) != nullptr) {
+      long long size, seconds, nanoseconds;
+      int pathStart;
+      if (sscanf(line, "%lld %lld %lld %n", &size, &seconds, &nanoseconds,
+                 &pathStart) != 3) {
+        return false;
+      }
+      line[strcspn(line, "\n")] = '\0';
+      struct stat info;
+      if (stat(line + pathStart, &info) != 0 || info.st_size != size ||
+          info.st_mtim.tv_sec != seconds ||
+          info.st_mtim.tv_nsec != nanoseconds) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Records the outputs a file was just generated into. Safe to call from
+  // several threads for different keys.
+  void store(uint64_t key, kj::ArrayPtr<const kj::String> outputs) const {
+    auto path = stamp_path(key);
+    auto temporary = kj::str(path, ".tmp");
+    FILE* stamp = fopen(temporary.cStr(), "w");
+    KJ_REQUIRE(stamp != nullptr, "could not write to the cache", temporary);
+    for (const auto& output : outputs) {
+      struct stat info;
+      KJ_REQUIRE(stat(output.cStr(), &info) == 0, "output went missing", output);
+      fprintf(stamp, "%lld %lld %lld %s\n", (long long)info.st_size,
+              (long long)info.st_mtim.tv_sec, (long long)info.st_mtim.tv_nsec,
+              output.cStr());
+    }
+    fclose(stamp);
+    KJ_REQUIRE(rename(temporary.cStr(), path.cStr()) == 0,
+               "could not write to the cache", path);
+  }
+
+ private:
+  kj::String dir_;
+  uint64_t salt_;
+  std::unordered_map<uint64_t, schema::Node::Reader> nodes_;
+  std::unordered_map<uint64_t, uint64_t> hashes_;
+  std::vector<uint64_t> pending_;
+  std::unordered_set<uint64_t> seen_;
+
+  kj::String stamp_path(uint64_t key) const {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+    return kj::str(dir_, '/', name);
+  }
+
+  void add(uint64_t id) {
+    if (seen_.insert(id).second) {
+      pending_.push_back(id);
+    }
+  }
+
+  void add_type(const schema::Type::Reader& type) {
+    switch (type.which()) {
+      case schema::Type::LIST:
+        add_type(type.getList().getElementType());
+        break;
+      case schema::Type::STRUCT:
+        add(type.getStruct().getTypeId());
+        add_brand(type.getStruct().getBrand());
+        break;
+      case schema::Type::ENUM:
+        add(type.getEnum().getTypeId());
+        add_brand(type.getEnum().getBrand());
+        break;
+      case schema::Type::INTERFACE:
+        add(type.getInterface().getTypeId());
+        add_brand(type.getInterface().getBrand());
+        break;
+      default:
+        break;
+    }
+  }
+
+  void add_brand(const schema::Brand::Reader& brand) {
+    for (const auto& scope : brand.getScopes()) {
+      add(scope.getScopeId());
+      if (scope.isBind()) {
+        for (const auto& binding : scope.getBind()) {
+          if (binding.isType()) {
+            add_type(binding.getType());
+          }
+        }
+      }
+    }
+  }
+
+  void add_annotations(const List<schema::Annotation>::Reader& annotations) {
+    for (const auto& annotation : annotations) {
+      add(annotation.getId());
+      add_brand(annotation.getBrand());
+    }
+  }
+
+  void add_node(const schema::Node::Reader& node) {
+    for (const auto& nested : node.getNestedNodes()) {
+      add(nested.getId());
+    }
+    add_annotations(node.getAnnotations());
+    switch (node.which()) {
+      case schema::Node::STRUCT:
+        for (const auto& field : node.getStruct().getFields()) {
+          add_annotations(field.getAnnotations());
+          if (field.isSlot()) {
+            add_type(field.getSlot().getType());
+          } else {
+            add(field.getGroup().getTypeId());
+          }
+        }
+        break;
+      case schema::Node::ENUM:
+        for (const auto& enumerant : node.getEnum().getEnumerants()) {
+          add_annotations(enumerant.getAnnotations());
+        }
+        break;
+      case schema::Node::INTERFACE: {
+        auto interface = node.getInterface();
+        for (const auto& superclass : interface.getSuperclasses()) {
+          add(superclass.getId());
+          add_brand(superclass.getBrand());
+        }
+        for (const auto& method : interface.getMethods()) {
+          add(method.getParamStructType());
+          add_brand(method.getParamBrand());
+          add(method.getResultStructType());
+          add_brand(method.getResultBrand());
+          add_annotations(method.getAnnotations());
+        }
+        break;
+      }
+      case schema::Node::CONST:
+        add_type(node.getConst().getType());
+        break;
+      case schema::Node::ANNOTATION:
+        add_type(node.getAnnotation().getType());
+        break;
+      default:
+        break;
+    }
+  }
+};
+
+// Generator may be a BaseGenerator subclass or a StaticGenerator<Generator>.
 template <class Generator>
 class CapnpcGenericMain {
+  static_assert(std::is_base_of<StaticGenerator<Generator>, Generator>::value ||
+                std::is_base_of<BaseGenerator, Generator>::value,
+                "Generator must derive from BaseGenerator or StaticGenerator");
+
  public:
   CapnpcGenericMain(kj::ProcessContext& context): context(context) {}
 
   kj::MainFunc getMain() {
-    return kj::MainBuilder(context, Generator::TITLE, Generator::DESCRIPTION)
+    kj::MainBuilder builder(context, Generator::TITLE, Generator::DESCRIPTION);
+    Generator::add_options(builder, generatorOptions);
+    return builder
+        .addOptionWithArg({'j', "jobs"}, KJ_BIND_METHOD(*this, setJobs), "<n>",
+                          "Generate the requested files on <n> threads, each "
+                          "with its own generator. 0 uses one per core.")
+        .addOptionWithArg({"request-file"}, KJ_BIND_METHOD(*this, setRequestFile),
+                          "<path>", "Read the CodeGeneratorRequest from <path> "
+                          "instead of stdin.")
+        .addOption({"lazy"}, KJ_BIND_METHOD(*this, enableLazy),
+                   "Only load the nodes the traversal reaches, instead of "
+                   "every node in the request.")
+        .addOption({"profile"}, KJ_BIND_METHOD(*this, enableProfile),
+                   "Time every hook the generator defines and print the "
+                   "calls, time and bytes emitted of each to stderr.")
+        .addOptionWithArg({"profile-json"}, KJ_BIND_METHOD(*this, setProfileJson),
+                          "<path>", "Like --profile, but write the report "
+                          "to <path> as JSON.")
+        .addOptionWithArg({"server"}, KJ_BIND_METHOD(*this, setServerSocket),
+                          "<socket>", "Stay running and serve requests from "
+                          "the client shim on the Unix socket <socket>, "
+                          "keeping the loaded schema nodes between requests.")
+        .addOption({"serve-stdin"}, KJ_BIND_METHOD(*this, enableServeStdin),
+                   "Like --server, but read the requests from stdin and "
+                   "write the responses to stdout.")
+        .addOptionWithArg({"cache-dir"}, KJ_BIND_METHOD(*this, setCacheDir),
+                          "<dir>", "Remember in <dir> what every requested "
+                          "file depended on and skip the ones whose schema "
+                          "nodes and options did not change since.")
+        .addOptionWithArg({"only-annotated"},
+                          KJ_BIND_METHOD(*this, addOnlyAnnotated), "<ids>",
+                          "Only generate the declarations carrying, or with "
+                          "a field, enumerant or method carrying, one of the "
+                          "comma-separated annotation <ids>, along with their "
+                          "enclosing scopes.")
+        .addOptionWithArg({"only-ids"}, KJ_BIND_METHOD(*this, addOnlyIds),
+                          "<ids>", "Only generate the nodes with the "
+                          "comma-separated <ids>, along with their enclosing "
+                          "scopes.")
+        .addOption({"stats"}, KJ_BIND_METHOD(*this, enableStats),
+                   "Print how the request was read, the time to the first "
+                   "loaded node, how many nodes were loaded, the peak RSS and "
+                   "the time spent in each phase to stderr.")
         .callAfterParsing(KJ_BIND_METHOD(*this, run))
         .build();
   }
 
  private:
   kj::ProcessContext& context;
-  SchemaLoader schemaLoader;
+  kj::Own<RequestNodeLoader> nodeLoader;
+  kj::Own<SchemaLoader> schemaLoader;
+  kj::Own<SchemaIndex> schemaIndex;
+  typename Generator::Options generatorOptions;
+  unsigned jobs = 1;
+  kj::String requestFile;
+  bool lazy = false;
+  bool stats = false;
+  bool profile = false;
+  kj::String profileJson;
+  HookProfile hookProfile;
+  kj::String serverSocket;
+  bool serveStdin = false;
+  // In server mode, the ids of the nodes in schemaLoader.
+  std::unordered_set<uint64_t> loadedNodes;
+  size_t reusedNodes = 0;
+  // What load_nodes spent checking the nodes it kept against the request,
+  // and loading the others, for --stats.
+  double reuseCheckMs = 0;
+  double nodeLoadMs = 0;
+  std::vector<uint64_t> onlyAnnotated;
+  std::vector<uint64_t> onlyIds;
+  size_t selectedNodes = 0;
+  kj::String cacheDir;
+  kj::Own<GenerationCache> cache;
+  std::vector<uint64_t> cacheKeys;
+  kj::AutoCloseFd requestFd;
+  kj::Own<MappedFile> mapping;
+  const char* readPath = "stream";
+  SchemaResolver::Stats resolutionStats;
+  OutputStats outputStats;
+
+  typedef schema::CodeGeneratorRequest::RequestedFile RequestedFile;
+
+  kj::MainBuilder::Validity setJobs(kj::StringPtr arg) {
+    char* end;
+    jobs = strtoul(arg.cStr(), &end, 10);
+    if (*end != '\0') {
+      return "expected a number of threads";
+    }
+    if (jobs == 0) {
+      jobs = kj::max(std::thread::hardware_concurrency(), 1u);
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity setRequestFile(kj::StringPtr path) {
+    requestFile = kj::heapString(path);
+    return true;
+  }
+
+  kj::MainBuilder::Validity enableLazy() {
+    lazy = true;
+    return true;
+  }
+
+  kj::MainBuilder::Validity enableStats() {
+    stats = true;
+    return true;
+  }
+
+  kj::MainBuilder::Validity setServerSocket(kj::StringPtr path) {
+    serverSocket = kj::heapString(path);
+    return true;
+  }
+
+  kj::MainBuilder::Validity enableServeStdin() {
+    serveStdin = true;
+    return true;
+  }
+
+  kj::MainBuilder::Validity addOnlyAnnotated(kj::StringPtr arg) {
+    return parse_ids(arg, onlyAnnotated);
+  }
+
+  kj::MainBuilder::Validity addOnlyIds(kj::StringPtr arg) {
+    return parse_ids(arg, onlyIds);
+  }
+
+  // Appends the comma-separated ids in arg, e.g. "0xa93fc509624c72d9,0x...".
+  static kj::MainBuilder::Validity parse_ids(kj::StringPtr arg,
+                                             std::vector<uint64_t>& ids) {
+    const char* pos = arg.cStr();
+    for (;;) {
+      char* end;
+      errno = 0;
+      uint64_t id = strtoull(pos, &end, 0);
+      if (end == pos || errno != 0 || (*end != ',' && *end != '\0')) {
+        return "expected comma-separated ids, like 0xa93fc509624c72d9";
+      }
+      ids.push_back(id);
+      if (*end == '\0') return true;
+      pos = end + 1;
+    }
+  }
+
+  kj::MainBuilder::Validity setCacheDir(kj::StringPtr path) {
+    if (!Generator::CACHEABLE) {
+      return kj::str(Generator::TITLE, " does not support --cache-dir");
+    }
+    if (mkdir(path.cStr(), 0777) != 0 && errno != EEXIST) {
+      return kj::str("could not create ", path);
+    }
+    // Absolute, since in server mode requests run in the client's directory.
+    char* absolute = realpath(path.cStr(), nullptr);
+    if (absolute == nullptr) {
+      return kj::str("could not resolve ", path);
+    }
+    cacheDir = kj::heapString(absolute);
+    free(absolute);
+    return true;
+  }
+
+  // Everything besides the schema that a generator's output depends on.
+  uint64_t cache_salt() {
+    char cwd[PATH_MAX];
+    KJ_REQUIRE(getcwd(cwd, sizeof(cwd)) != nullptr, "could not get the cwd");
+    auto identity = kj::str(Generator::TITLE, '\n', VERSION, '\n',
+                            Generator::options_key(generatorOptions), '\n',
+                            cwd);
+    uint64_t hash = hash_bytes(HASH_SEED, identity.begin(), identity.size());
+    // A selection leaves parts of the outputs out.
+    for (const auto* ids : {&onlyAnnotated, &onlyIds}) {
+      uint64_t count = ids->size();
+      hash = hash_bytes(hash, &count, sizeof(count));
+      hash = hash_bytes(hash, ids->data(), count * sizeof(uint64_t));
+    }
+    // A rebuilt generator may generate differently under the same version.
+    struct stat binary;
+    if (stat("/proc/self/exe", &binary) == 0) {
+      hash = hash_bytes(hash, &binary.st_size, sizeof(binary.st_size));
+      hash = hash_bytes(hash, &binary.st_mtim, sizeof(binary.st_mtim));
+    }
+    return hash;
+  }
+
+  kj::MainBuilder::Validity enableProfile() {
+    if (!Profiled<Generator>::SUPPORTED) {
+      return kj::str(Generator::TITLE, " overrides traverse_* methods, which "
+                     "--profile would not run");
+    }
+    profile = true;
+    return true;
+  }
+
+  kj::MainBuilder::Validity setProfileJson(kj::StringPtr path) {
+    profileJson = kj::heapString(path);
+    return enableProfile();
+  }
+
+  // Generators with their own options get them passed to the constructor.
+  // G is either Generator or, with --profile, Profiled<Generator>.
+  template <class G>
+  kj::Own<G> new_generator() {
+    auto generator = make_generator<G>(*schemaLoader, generatorOptions);
+    generator->schemaIndex = schemaIndex.get();
+    return generator;
+  }
+
+  // Called once per generator after its finish().
+  template <class G>
+  void collect_stats(const G& generator) {
+    resolutionStats += generator.resolution_stats();
+    outputStats += generator.output_stats();
+  }
+  template <class Inner, bool Virtual>
+  void collect_stats(const Profiled<Inner, Virtual>& generator) {
+    resolutionStats += generator.resolution_stats();
+    outputStats += generator.output_stats();
+    hookProfile += generator.profile();
+  }
+
+  // Generates the requested files at the given indices; with --cache-dir,
+  // the ones that are not fresh.
+  template <class G>
+  void generate(const List<RequestedFile>::Reader& requestedFiles,
+                const std::vector<unsigned>& pending) {
+    if (jobs > 1 && G::PARALLEL_SAFE && pending.size() > 1) {
+      generate_parallel<G>(requestedFiles, pending);
+    } else {
+      auto generator = new_generator<G>();
+      for (unsigned index : pending) {
+        generate_file(*generator, requestedFiles[index], index);
+      }
+      generator->finish();
+      generator->flush_outputs();
+      collect_stats(*generator);
+    }
+  }
+
+  template <class G>
+  void generate_file(G& generator, const RequestedFile::Reader& requestedFile,
+                     unsigned index) {
+    size_t outputsBefore = generator.outputs().size();
+    const auto& schema = schemaLoader->get(requestedFile.getId());
+    generator.traverse_file(schema, requestedFile);
+    if (cache != nullptr) {
+      // The stamps are taken from the files on disk.
+      generator.flush_outputs();
+      const auto& outputs = generator.outputs();
+      cache->store(cacheKeys[index],
+                   kj::arrayPtr(outputs.data() + outputsBefore,
+                                outputs.size() - outputsBefore));
+    }
+  }
+
+  // A request in a regular file is mapped and read in place; anything else,
+  // like the pipe capnpc hands us, is streamed into heap segments.
+  kj::Own<MessageReader> read_request(int fd, const ReaderOptions& options) {
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 &&
+        info.st_size % sizeof(word) == 0 && lseek(fd, 0, SEEK_CUR) == 0) {
+      void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        mapping = kj::heap<MappedFile>(data, info.st_size);
+        readPath = "mmap";
+        return kj::heap<FlatArrayMessageReader>(mapping->words(), options);
+      }
+    }
+    readPath = "stream";
+    return kj::heap<StreamFdMessageReader>(fd, options);
+  }
+
+  // Hands the requested files out to the workers one at a time. The
+  // SchemaLoader is shared, every worker has its own generator, and each
+  // one finishes after its last file.
+  template <class G>
+  void generate_parallel(const List<RequestedFile>::Reader& requestedFiles,
+                         const std::vector<unsigned>& pending) {
+    unsigned workers = kj::min(jobs, static_cast<unsigned>(pending.size()));
+    std::atomic<unsigned> next(0);
+    std::mutex statsMutex;
+    std::vector<kj::Maybe<kj::Exception>> errors(workers);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < workers; ++i) {
+      threads.emplace_back([&, i]() {
+        errors[i] = kj::runCatchingExceptions([&]() {
+          auto generator = new_generator<G>();
+          for (unsigned i = next++; i < pending.size(); i = next++) {
+            generate_file(*generator, requestedFiles[pending[i]], pending[i]);
+          }
+          generator->finish();
+          generator->flush_outputs();
+          std::lock_guard<std::mutex> lock(statsMutex);
+          collect_stats(*generator);
+        });
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (auto& error : errors) {
+      KJ_IF_MAYBE(exception, error) {
+        kj::throwFatalException(kj::mv(*exception));
+      }
+    }
+  }
 
   kj::MainBuilder::Validity run() {
 #if USE_DEATH_HANDLER
     Debug::DeathHandler dh;
 #endif
+    if (serverSocket != nullptr || serveStdin) {
+      if (lazy) {
+        context.warning("--lazy is ignored in server mode, nodes are kept "
+                        "loaded across requests");
+        lazy = false;
+      }
+      // Don't die with a client that went away before its response.
+      signal(SIGPIPE, SIG_IGN);
+      if (serveStdin) {
+        serve(STDIN_FILENO, STDOUT_FILENO);
+        return true;
+      }
+      return serve_socket();
+    }
+
+    int fd = STDIN_FILENO;
+    if (requestFile != nullptr) {
+      requestFd = kj::AutoCloseFd(open(requestFile.cStr(), O_RDONLY));
+      if (requestFd.get() < 0) {
+        return kj::str("could not open ", requestFile);
+      }
+      fd = requestFd.get();
+    }
+    process_request(fd, true);
+    return true;
+  }
+
+  // Server mode. Each request on a connection, or on stdin, is framed as
+  //   uint32 length, the client's working directory (length bytes),
+  //   a CodeGeneratorRequest in the standard stream framing
+  // and answered with
+  //   uint32 status (0 on success), uint32 length, an error (length bytes).
+  // Requests are handled one at a time, in the client's directory. After a
+  // failed request the connection is closed once the error is sent: the
+  // request may not have been read to its end, so what follows on the
+  // connection can't be trusted to be the next one. client.c++ is the
+  // matching plugin shim.
+  kj::MainBuilder::Validity serve_socket() {
+    kj::AutoCloseFd listener(socket(AF_UNIX, SOCK_STREAM, 0));
+    if (listener.get() < 0) {
+      return "could not create a socket";
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (serverSocket.size() >= sizeof(address.sun_path)) {
+      return "socket path too long";
+    }
+    strcpy(address.sun_path, serverSocket.cStr());
+    unlink(address.sun_path);  // Left behind by an earlier server.
+    if (bind(listener.get(), reinterpret_cast<struct sockaddr*>(&address),
+             sizeof(address)) < 0 ||
+        listen(listener.get(), SOMAXCONN) < 0) {
+      return kj::str("could not listen on ", serverSocket);
+    }
+    for (;;) {
+      kj::AutoCloseFd connection(accept(listener.get(), nullptr, nullptr));
+      if (connection.get() < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return "accept failed";
+      }
+      // A client that goes away mid-request only loses its connection.
+      auto failure = kj::runCatchingExceptions([&]() {
+        serve(connection.get(), connection.get());
+      });
+      KJ_IF_MAYBE(exception, failure) {
+        context.warning(kj::str("dropped a connection: ",
+                                exception->getDescription()));
+      }
+    }
+  }
+
+  // Handles requests from `in` until it is closed.
+  void serve(int in, int out) {
+    kj::FdInputStream input(in);
+    kj::FdOutputStream output(out);
+    int originalDir = open(".", O_RDONLY);
+    auto _ = Finally([&](){ close(originalDir); });
+    for (;;) {
+      uint32_t cwdSize;
+      if (input.tryRead(&cwdSize, sizeof(cwdSize), sizeof(cwdSize)) == 0) {
+        return;
+      }
+      if (cwdSize >= PATH_MAX) {
+        context.warning("request framing is off, closing the connection");
+        return;
+      }
+      kj::String cwd = kj::heapString(cwdSize);
+      input.read(cwd.begin(), cwdSize);
+
+      kj::String error;
+      auto failure = kj::runCatchingExceptions([&]() {
+        KJ_REQUIRE(chdir(cwd.cStr()) == 0, "could not change directory", cwd);
+        process_request(in, false);
+      });
+      KJ_IF_MAYBE(exception, failure) {
+        error = kj::str(exception->getDescription());
+        // Whatever was loaded so far may not match what was asked for.
+        schemaIndex = nullptr;
+        schemaLoader = nullptr;
+        loadedNodes.clear();
+      }
+      if (fchdir(originalDir) != 0) {
+        context.warning("could not change back to the server's directory");
+      }
+
+      uint32_t header[2] = {error == nullptr ? 0u : 1u,
+                            static_cast<uint32_t>(error.size())};
+      const kj::ArrayPtr<const kj::byte> pieces[2] = {
+          kj::arrayPtr(reinterpret_cast<const kj::byte*>(header),
+                       sizeof(header)),
+          error.asBytes()};
+      output.write(kj::arrayPtr(pieces, 2));
+      if (error != nullptr) {
+        return;
+      }
+    }
+  }
+
+  // Same as SchemaLoader::load for every node, except that in server mode
+  // nodes already loaded by an earlier request are kept as they are. They
+  // are compared in place with the loader's copy, which neither copies nor
+  // allocates. When any of them changed, e.g. after a schema edit, the
+  // loader is started over: a SchemaLoader can't replace a node.
+  void load_nodes(const List<schema::Node>::Reader& nodes) {
+    bool serving = serverSocket != nullptr || serveStdin;
+    if (schemaLoader != nullptr && serving) {
+      Stopwatch check;
+      bool changed = false;
+      for (const auto& node: nodes) {
+        if (loadedNodes.count(node.getId()) != 0 &&
+            !(AnyStruct::Reader(node) ==
+              AnyStruct::Reader(
+                  schemaLoader->getUnbound(node.getId()).getProto()))) {
+          changed = true;
+          break;
+        }
+      }
+      reuseCheckMs = check.elapsed_ms();
+      if (!changed) {
+        Stopwatch load;
+        for (const auto& node: nodes) {
+          if (loadedNodes.insert(node.getId()).second) {
+            schemaLoader->load(node);
+          } else {
+            reusedNodes++;
+          }
+        }
+        nodeLoadMs = load.elapsed_ms();
+        return;
+      }
+    }
+    Stopwatch load;
+    schemaIndex = nullptr;
+    schemaLoader = kj::heap<SchemaLoader>();
+    loadedNodes.clear();
+    for (const auto& node: nodes) {
+      schemaLoader->load(node);
+      if (serving) {
+        loadedNodes.insert(node.getId());
+      }
+    }
+    nodeLoadMs = load.elapsed_ms();
+  }
+
+
+  // Marks the nodes --only-annotated and --only-ids ask for in schemaIndex.
+  // Annotated members select the node they belong to.
+  void select() {
+    std::vector<uint32_t> matches;
+    for (uint64_t annotationId : onlyAnnotated) {
+      for (const auto& annotated : schemaIndex->annotated(annotationId)) {
+        matches.push_back(annotated.entry);
+      }
+    }
+    for (uint64_t id : onlyIds) {
+      if (const auto* entry = schemaIndex->find(id)) {
+        matches.push_back(schemaIndex->position(*entry));
+      } else {
+        context.warning(kj::str("--only-ids: no node 0x", kj::hex(id),
+                                " in the requested files"));
+      }
+    }
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    schemaIndex->select(matches);
+    selectedNodes = matches.size();
+  }
+
+  void process_request(int fd, bool allowMmap) {
+    Stopwatch stopwatch;
+    resolutionStats = SchemaResolver::Stats();
+    outputStats = OutputStats();
+    hookProfile = HookProfile();
+    reusedNodes = 0;
+    reuseCheckMs = 0;
+    nodeLoadMs = 0;
+
     ReaderOptions options;
     options.traversalLimitInWords = Generator::TRAVERSAL_LIMIT;
-    StreamFdMessageReader reader(STDIN_FILENO, options);
-    const auto& request = reader.getRoot<schema::CodeGeneratorRequest>();
+    kj::Own<MessageReader> reader;
+    if (allowMmap) {
+      reader = read_request(fd, options);
+    } else {
+      readPath = "stream";
+      reader = kj::heap<StreamFdMessageReader>(fd, options);
+    }
+    const auto& request = reader->getRoot<schema::CodeGeneratorRequest>();
+    double readMs = stopwatch.elapsed_ms();
+
+    const auto& nodes = request.getNodes();
+    const auto& requestedFiles = request.getRequestedFiles();
+    double firstNodeMs = -1;
+    if (lazy) {
+      nodeLoader = kj::heap<RequestNodeLoader>(nodes);
+      schemaLoader = kj::heap<SchemaLoader>(*nodeLoader);
+      if (requestedFiles.size() > 0) {
+        schemaLoader->get(requestedFiles[0].getId());
+        firstNodeMs = stopwatch.elapsed_ms();
+      }
+    } else {
+      // Load the nodes first, we'll use them later.
+      load_nodes(nodes);
+      firstNodeMs = stopwatch.elapsed_ms();
+    }
+
+    schemaIndex = kj::heap<SchemaIndex>(*schemaLoader, requestedFiles);
+    bool selective = !onlyAnnotated.empty() || !onlyIds.empty();
+    if (selective) {
+      select();
+    }
+    double loadMs = stopwatch.elapsed_ms() - readMs;
 
-    // Load the nodes first, we'll use them later.
-    for (const auto& node: request.getNodes()) {
-      schemaLoader.load(node);
+    if (jobs > 1 && !Generator::PARALLEL_SAFE) {
+      context.warning(kj::str(Generator::TITLE,
+                              " does not support --jobs, generating serially"));
+    }
+    std::vector<unsigned> pending;
+    cache = nullptr;
+    cacheKeys.clear();
+    if (cacheDir != nullptr) {
+      cache = kj::heap<GenerationCache>(cacheDir, cache_salt(), nodes);
+    }
+    size_t unselectedFiles = 0;
+    for (unsigned i = 0; i < requestedFiles.size(); ++i) {
+      if (cache != nullptr) {
+        cacheKeys.push_back(cache->key(requestedFiles[i]));
+      }
+      if (selective && schemaIndex->find(requestedFiles[i].getId())
+                               ->selection == SchemaIndex::UNSELECTED) {
+        unselectedFiles++;
+      } else if (cache == nullptr || !cache->fresh(cacheKeys.back())) {
+        pending.push_back(i);
+      }
     }
 
-    Generator generator(schemaLoader);
-    for (const auto& requestedFile: request.getRequestedFiles()) {
-      const auto& schema = schemaLoader.get(requestedFile.getId());
-      generator.traverse_file(schema, requestedFile);
+    if (profile) {
+      generate<Profiled<Generator>>(requestedFiles, pending);
+    } else {
+      generate<Generator>(requestedFiles, pending);
     }
-    generator.finish();
     fflush(stdout);
+    double generateMs = stopwatch.elapsed_ms() - readMs - loadMs;
 
-    return true;
+    if (stats) {
+      struct rusage usage;
+      getrusage(RUSAGE_SELF, &usage);
+      size_t loaded = lazy ? nodeLoader->loaded() : nodes.size() - reusedNodes;
+      fprintf(stderr, "read: %s, first node after %.3f ms, "
+              "loaded %zu of %u nodes (%zu already loaded), "
+              "peak RSS %ld KiB\n",
+              readPath, firstNodeMs, loaded, nodes.size(), reusedNodes,
+              usage.ru_maxrss);
+      if ((serverSocket != nullptr || serveStdin) && !lazy) {
+        // Per node, so that keeping a node can be told apart from loading it
+        // again.
+        size_t loadedNow = nodes.size() - reusedNodes;
+        fprintf(stderr, "node reuse: %zu kept, checked in %.3f ms "
+                "(%.3f us each); %zu loaded in %.3f ms (%.3f us each)\n",
+                reusedNodes, reuseCheckMs,
+                reusedNodes > 0 ? reuseCheckMs * 1000 / reusedNodes : 0.0,
+                loadedNow, nodeLoadMs,
+                loadedNow > 0 ? nodeLoadMs * 1000 / loadedNow : 0.0);
+      }
+      fprintf(stderr, "schema resolution: %zu hits, %zu misses\n",
+              resolutionStats.hits, resolutionStats.misses);
+      // With --jobs the write time is summed over the workers.
+      fprintf(stderr, "phases: read %.3f ms, load %.3f ms, generate %.3f ms, "
+              "of which writing %zu files (%zu unchanged, %zu bytes) "
+              "%.3f ms\n",
+              readMs, loadMs, generateMs, outputStats.files,
+              outputStats.unchanged, outputStats.bytes, outputStats.ms);
+      if (outputStats.background > 0) {
+        fprintf(stderr, "background writes: %zu files in %.3f ms, latency "
+                "%.3f ms mean, %.3f ms max, %zu stalls on a full queue\n",
+                outputStats.background, outputStats.backgroundMs,
+                outputStats.latencyMs / outputStats.background,
+                outputStats.maxLatencyMs, outputStats.stalls);
+      }
+      if (selective) {
+        fprintf(stderr, "selection: %zu nodes, %zu of %u requested files "
+                "without any\n", selectedNodes, unselectedFiles,
+                requestedFiles.size());
+      }
+      if (cache != nullptr) {
+        fprintf(stderr, "cache: %zu of %u requested files up to date\n",
+                requestedFiles.size() - unselectedFiles - pending.size(),
+                requestedFiles.size());
+      }
+    }
 
+    if (profile) {
+      if (profileJson != nullptr) {
+        FILE* out = fopen(profileJson.cStr(), "w");
+        KJ_REQUIRE(out != nullptr, "could not open", profileJson);
+        hookProfile.write_json(out);
+        fclose(out);
+      } else {
+        hookProfile.print(stderr);
+      }
+    }
   }
 
 };
-
-
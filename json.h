@@ -0,0 +1,1090 @@
+#include <string.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "generic.h"
+#include "rapidjson/document.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/writer.h"
+
+// Holds a whole file's JSON in memory so it goes out in a single write. The
+// capacity is kept from one file to the next.
+class JsonOutputBuffer {
+ public:
+  typedef char Ch;
+  JsonOutputBuffer(size_t capacity) { buffer_.reserve(capacity); }
+  void Put(char c) { buffer_.push_back(c); }
+  void Flush() {}
+  void clear() { buffer_.clear(); }
+  const char* data() const { return buffer_.data(); }
+  size_t size() const { return buffer_.size(); }
+  std::string& string() { return buffer_; }
+ private:
+  std::string buffer_;
+};
+
+// rapidjson's Writer and PrettyWriter share their interface but not a
+// virtual base, so the hooks write through this and --compact costs a
+// predictable branch per call rather than a second copy of every hook.
+class JsonWriter {
+ public:
+  JsonWriter(JsonOutputBuffer& buffer, bool pretty)
+      : compact_(buffer), pretty_(buffer), isPretty_(pretty) {}
+
+#define FORWARD_TO_WRITER(method) \
+  template <typename... Args> \
+  bool method(Args... args) { \
+    return isPretty_ ? pretty_.method(args...) : compact_.method(args...); \
+  }
+  FORWARD_TO_WRITER(Null)
+  FORWARD_TO_WRITER(Bool)
+  FORWARD_TO_WRITER(Int)
+  FORWARD_TO_WRITER(Uint)
+  FORWARD_TO_WRITER(Int64)
+  FORWARD_TO_WRITER(Uint64)
+  FORWARD_TO_WRITER(Double)
+  FORWARD_TO_WRITER(String)
+  FORWARD_TO_WRITER(Key)
+  FORWARD_TO_WRITER(StartObject)
+  FORWARD_TO_WRITER(EndObject)
+  FORWARD_TO_WRITER(StartArray)
+  FORWARD_TO_WRITER(EndArray)
+#undef FORWARD_TO_WRITER
+
+ private:
+  rapidjson::Writer<JsonOutputBuffer> compact_;
+  rapidjson::PrettyWriter<JsonOutputBuffer> pretty_;
+  bool isPretty_;
+};
+
+// How Data values are written: as one base64 or hex JSON string, or as an
+// array of one-character strings, one per byte.
+enum class DataEncoding { BASE64, HEX, ARRAY };
+
+// Shared by both flavours of the generator, so e.g. the benchmark can parse
+// them once and hand them to either.
+struct JsonOptions {
+  bool compact = false;
+  size_t bufferSize = 16 << 20;
+  size_t outputQueue = 1;
+  DataEncoding dataEncoding = DataEncoding::BASE64;
+  bool typeTable = false;
+};
+
+// The encoders for a Data value written as one JSON string. Both write into
+// a caller-owned buffer, so it can be reused for every Data value in the file,
+// and resize it once up front. Base64 encodes three input bytes at a time
+// through its alphabet; hex copies each byte's two characters from a table.
+inline void encode_base64(kj::ArrayPtr<const kj::byte> data, std::string& out) {
+  static const char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t size = data.size();
+  out.resize((size + 2) / 3 * 4);
+  const kj::byte* in = data.begin();
+  char* dest = &out[0];
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3, dest += 4) {
+    uint32_t group = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+    dest[0] = alphabet[(group >> 18) & 0x3f];
+    dest[1] = alphabet[(group >> 12) & 0x3f];
+    dest[2] = alphabet[(group >> 6) & 0x3f];
+    dest[3] = alphabet[group & 0x3f];
+  }
+  if (i < size) {
+    uint32_t group = in[i] << 16;
+    if (i + 1 < size) group |= in[i + 1] << 8;
+    dest[0] = alphabet[(group >> 18) & 0x3f];
+    dest[1] = alphabet[(group >> 12) & 0x3f];
+    dest[2] = i + 1 < size ? alphabet[(group >> 6) & 0x3f] : '=';
+    dest[3] = '=';
+  }
+}
+
+inline void encode_hex(kj::ArrayPtr<const kj::byte> data, std::string& out) {
+  // A byte's two output characters, copied together as one char[2].
+  static const struct HexTable {
+    char pairs[256][2];
+    HexTable() {
+      static const char digits[] = "0123456789abcdef";
+      for (int i = 0; i < 256; i++) {
+        pairs[i][0] = digits[i >> 4];
+        pairs[i][1] = digits[i & 0xf];
+      }
+    }
+  } table;
+  out.resize(data.size() * 2);
+  char* dest = &out[0];
+  for (auto byte : data) {
+    memcpy(dest, table.pairs[byte], 2);
+    dest += 2;
+  }
+}
+
+// The JSON hooks, written once and mixed into either generator flavour:
+// CapnpcJson below uses BaseGenerator's virtual hooks and StaticCapnpcJson
+// resolves them at compile time.
+template <class Base>
+class CapnpcJsonGenerator : public Base {
+ public:
+  typedef JsonOptions Options;
+
+  static void add_options(kj::MainBuilder& builder, Options& options) {
+    builder.addOption(
+        {"compact"},
+        [&options]() -> kj::MainBuilder::Validity {
+          options.compact = true;
+          return true;
+        },
+        "Write JSON without indentation or newlines.");
+    builder.addOptionWithArg(
+        {"buffer-size"},
+        [&options](kj::StringPtr arg) -> kj::MainBuilder::Validity {
+          char* end;
+          options.bufferSize = strtoull(arg.cStr(), &end, 10);
+          if (*end != '\0') {
+            return "expected a size in bytes";
+          }
+          return true;
+        },
+        "<bytes>", "Initial size of the in-memory buffer each output file is "
+        "formatted into before it is written out at once. Default 16 MiB.");
+    builder.addOptionWithArg(
+        {"output-queue"},
+        [&options](kj::StringPtr arg) -> kj::MainBuilder::Validity {
+          char* end;
+          options.outputQueue = strtoull(arg.cStr(), &end, 10);
+          if (*end != '\0') {
+            return "expected a number of files";
+          }
+          return true;
+        },
+        "<files>", "How many finished output files may wait for a background "
+        "thread to write them while the next one is formatted. 0 writes each "
+        "file before going on to the next. Default 1.");
+    builder.addOptionWithArg(
+        {"data-encoding"},
+        [&options](kj::StringPtr arg) -> kj::MainBuilder::Validity {
+          if (arg == "base64") {
+            options.dataEncoding = DataEncoding::BASE64;
+          } else if (arg == "hex") {
+            options.dataEncoding = DataEncoding::HEX;
+          } else if (arg == "array") {
+            options.dataEncoding = DataEncoding::ARRAY;
+          } else {
+            return "expected base64, hex or array";
+          }
+          return true;
+        },
+        "<encoding>", "How Data values are written: base64 (default) or hex "
+        "as a single string, or array for the old one-string-per-byte form.");
+    builder.addOption(
+        {"type-table"},
+        [&options]() -> kj::MainBuilder::Validity {
+          options.typeTable = true;
+          return true;
+        },
+        "Describe each struct, enum and interface type once, in a \"types\" "
+        "array at the end of the file, and refer to it by its index there "
+        "wherever it is used.");
+  }
+
+  // --buffer-size and --output-queue don't change the output.
+  static kj::String options_key(const Options& options) {
+    return kj::str("compact=", options.compact, " data-encoding=",
+                   static_cast<int>(options.dataEncoding), " type-table=",
+                   options.typeTable);
+  }
+
+  CapnpcJsonGenerator(SchemaLoader &schemaLoader,
+                      const Options& options = Options())
+      : Base(schemaLoader), options_(options), buffer_(options.bufferSize) {
+    this->use_output_sink(options.outputQueue);
+  }
+
+  void finish() {
+  }
+
+  size_t bytes_emitted() const {
+    return emitted_ + buffer_.size();
+  }
+
+  constexpr static const char FILE_SUFFIX[] = ".json";
+  const static auto TRAVERSAL_LIMIT = 1 << 30;  // Don't limit.
+  constexpr static const char *TITLE = "JSON Generator";
+  constexpr static const char *DESCRIPTION = "JSON Generator";
+  // Every requested file gets its own .json, nothing is shared.
+  constexpr static bool PARALLEL_SAFE = true;
+  constexpr static bool CACHEABLE = true;
+
+ private:
+  Options options_;
+  JsonOutputBuffer buffer_;
+  // What earlier files wrote to buffer_ before it was handed over.
+  size_t emitted_ = 0;
+  std::unique_ptr<JsonWriter> writer;
+  kj::String outputFilename_;
+  std::string dataScratch_;
+  // With --type-table, the types referenced so far in this file, by id, and
+  // their indices in typeTable_.
+  std::unordered_map<uint64_t, uint32_t> typeRefs_;
+  std::vector<std::pair<const char*, Schema>> typeTable_;
+
+  // Keys the value about to be written by where it is: a field of a struct
+  // value under its name, a list element not at all.
+  void start_value() {
+    const auto& frame = this->context().top();
+    switch (frame.role) {
+      case TraversalContext::ELEMENT:
+        break;
+      case TraversalContext::VALUE_FIELD:
+        writer->Key(frame.name.cStr(), frame.name.size());
+        break;
+      case TraversalContext::DEFAULT_VALUE:
+        writer->Key("default");
+        break;
+      default:
+        writer->Key("value");
+        break;
+    }
+  }
+
+  /*[[[cog
+  writers = {'bool': 'Bool', 'int64': 'Int64', 'uint64': 'Uint64',
+             'float32': 'Double', 'float64': 'Double'}
+  for name, _, param in primitive_types:
+    method = writers.get(name, 'Uint' if name.startswith('u') else 'Int')
+    cog.outl('void write_scalar(%s value) { writer->%s(value); }' % (param, method))
+  ]]]*/
+  void write_scalar(bool value) { writer->Bool(value); }
+  void write_scalar(int8_t value) { writer->Int(value); }
+  void write_scalar(int16_t value) { writer->Int(value); }
+  void write_scalar(int32_t value) { writer->Int(value); }
+  void write_scalar(int64_t value) { writer->Int64(value); }
+  void write_scalar(uint8_t value) { writer->Uint(value); }
+  void write_scalar(uint16_t value) { writer->Uint(value); }
+  void write_scalar(uint32_t value) { writer->Uint(value); }
+  void write_scalar(uint64_t value) { writer->Uint64(value); }
+  void write_scalar(float value) { writer->Double(value); }
+  void write_scalar(double value) { writer->Double(value); }
+  //[[[end]]]
+  void write_type_entry(const char* which, const Schema& schema) {
+    writer->StartObject();
+    writer->Key("which");
+    writer->String(which);
+    writer->Key("typeId");
+    writer->Uint64(schema.getProto().getId());
+    writer->Key("name");
+    writer->String(schema.getShortDisplayName().cStr());
+    writer->EndObject();
+  }
+
+  // A struct, enum or interface type where it is used. With --type-table,
+  // only the first use in a file resolves it; the entry, and its name, are
+  // written once by post_visit_file. The entry doesn't depend on the brand,
+  // so all brandings of a generic share it.
+  void write_type_ref(const char* which, uint64_t id,
+                      const schema::Brand::Reader& brand, const Schema& scope) {
+    if (!options_.typeTable) {
+      write_type_entry(which, this->resolve(id, brand, scope));
+      return;
+    }
+    auto ref = typeRefs_.emplace(id, typeTable_.size());
+    if (ref.second) {
+      typeTable_.emplace_back(which, this->resolve(id, brand, scope));
+    }
+    writer->Uint(ref.first->second);
+  }
+
+  void write_scalar(const Text::Reader& value) {
+    writer->String(value.cStr(), value.size());
+  }
+  void write_scalar(const Data::Reader& data) {
+    switch (options_.dataEncoding) {
+      case DataEncoding::BASE64:
+        encode_base64(data, dataScratch_);
+        writer->String(dataScratch_.data(), dataScratch_.size());
+        break;
+      case DataEncoding::HEX:
+        encode_hex(data, dataScratch_);
+        writer->String(dataScratch_.data(), dataScratch_.size());
+        break;
+      case DataEncoding::ARRAY:
+        writer->StartArray();
+        for (auto byte : data) {
+          writer->String(reinterpret_cast<const char*>(&byte), 1);
+        }
+        writer->EndArray();
+        break;
+    }
+  }
+
+ public:
+
+  bool pre_visit_file(const Schema& schema, const schema::CodeGeneratorRequest::RequestedFile::Reader& requestedFile) {
+    auto inputFilename = requestedFile.getFilename();
+    KJ_IF_MAYBE(loc, inputFilename.findLast('.')) {
+      outputFilename_ = kj::str(inputFilename.slice(0, *loc), FILE_SUFFIX);
+    } else {
+      outputFilename_ = kj::str(inputFilename, FILE_SUFFIX);
+    }
+    writer.reset(new JsonWriter(buffer_, !options_.compact));
+    typeRefs_.clear();
+    typeTable_.clear();
+
+    auto proto = schema.getProto();
+    writer->StartObject();
+    writer->Key("id");
+    writer->Uint64(proto.getId());
+    writer->Key("name");
+    writer->String(proto.getDisplayName().cStr());
+    return false;
+  }
+
+  bool post_visit_file(const Schema&, const schema::CodeGeneratorRequest::RequestedFile::Reader&) {
+    if (options_.typeTable) {
+      writer->Key("types");
+      writer->StartArray();
+      for (const auto& entry : typeTable_) {
+        write_type_entry(entry.first, entry.second);
+      }
+      writer->EndArray();
+    }
+    writer->EndObject();
+    writer.reset(nullptr);
+
+    emitted_ += buffer_.size();
+    this->write_output(outputFilename_, buffer_.string());
+    return false;
+  }
+
+  bool pre_visit_nested_decls(const Schema&) {
+    writer->Key("nodes");
+    writer->StartArray();
+    return false;
+  }
+
+  bool post_visit_nested_decls(const Schema&) {
+    writer->EndArray();
+    return false;
+  }
+
+  bool pre_visit_decl(const Schema& schema, const schema::Node::NestedNode::Reader& decl) {
+    writer->StartObject();
+    writer->Key("id");
+    writer->Uint64(decl.getId());
+    auto proto = schema.getProto();
+    writer->Key("scopeId");
+    writer->Uint64(proto.getScopeId());
+    writer->Key("which");
+    switch (proto.which()) {
+      /*[[[cog
+      types = ['struct', 'enum', 'interface', 'file', 'const', 'annotation'];
+      for type in types:
+        cog.outl('case schema::Node::%s:' % type.upper())
+        cog.outl('  writer->String("%s");' % type.lower())
+        cog.outl('  break;')
+      ]]]*/
+      case schema::Node::STRUCT:
+        writer->String("struct");
+        break;
+      case schema::Node::ENUM:
+        writer->String("enum");
+        break;
+      case schema::Node::INTERFACE:
+        writer->String("interface");
+        break;
+      case schema::Node::FILE:
+        writer->String("file");
+        break;
+      case schema::Node::CONST:
+        writer->String("const");
+        break;
+      case schema::Node::ANNOTATION:
+        writer->String("annotation");
+        break;
+      //[[[end]]]
+      default:
+        break;
+    }
+    writer->Key("name");
+    writer->String(schema.getShortDisplayName().cStr());
+    return false;
+  }
+
+  bool post_visit_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_const_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->Key("const");
+    writer->StartObject();
+    return false;
+  }
+
+  bool post_visit_const_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_enum_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->Key("enum");
+    writer->StartObject();
+    return false;
+  }
+
+  bool post_visit_enum_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_enumerants(const Schema&, const EnumSchema::EnumerantList&) {
+    writer->Key("enumerants");
+    writer->StartArray();
+    return false;
+  }
+
+  bool post_visit_enumerants(const Schema&, const EnumSchema::EnumerantList&) {
+    writer->EndArray();
+    return false;
+  }
+
+  bool pre_visit_enumerant(const Schema&, const EnumSchema::Enumerant& enumerant) {
+    writer->StartObject();
+    writer->Key("name");
+    writer->String(enumerant.getProto().getName().cStr());
+    writer->Key("ordinal");
+    writer->Uint(enumerant.getOrdinal());
+    return false;
+  }
+
+  bool post_visit_enumerant(const Schema&, const EnumSchema::Enumerant&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_annotation_decl(const Schema& schema, const schema::Node::NestedNode::Reader&) {
+    auto proto = schema.getProto().getAnnotation();
+
+    writer->Key("annotation");
+    {
+      writer->StartObject();
+      writer->Key("targets");
+      {
+        writer->StartObject();
+        /*[[[cog
+        targets = [
+            'struct', 'interface', 'group', 'enum', 'file', 'field', 'union',
+            'group', 'enumerant', 'annotation', 'const', 'param', 'method',
+        ]
+        for target in targets:
+          if smaller_annotations:
+            cog.outl('if (proto.getTargets%s()) {' % target.title())
+            cog.outl('  writer->Key("%s");' % target.lower())
+            cog.outl('  writer->Bool(true);')
+            cog.outl('}')
+          else:
+            cog.outl('writer->Key("%s");' % target.lower())
+            cog.outl('writer->Bool(proto.getTargets%s());' % target.title())
+        ]]]*/
+        if (proto.getTargetsStruct()) {
+          writer->Key("struct");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsInterface()) {
+          writer->Key("interface");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsGroup()) {
+          writer->Key("group");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsEnum()) {
+          writer->Key("enum");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsFile()) {
+          writer->Key("file");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsField()) {
+          writer->Key("field");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsUnion()) {
+          writer->Key("union");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsGroup()) {
+          writer->Key("group");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsEnumerant()) {
+          writer->Key("enumerant");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsAnnotation()) {
+          writer->Key("annotation");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsConst()) {
+          writer->Key("const");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsParam()) {
+          writer->Key("param");
+          writer->Bool(true);
+        }
+        if (proto.getTargetsMethod()) {
+          writer->Key("method");
+          writer->Bool(true);
+        }
+        //[[[end]]]
+        writer->EndObject();
+      }
+    }
+    return false;
+  }
+
+  bool post_visit_annotation_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_struct_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->Key("struct");
+    writer->StartObject();
+    return false;
+  }
+
+  bool post_visit_struct_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_type(const Schema& schema, const schema::Type::Reader& type) {
+    bool element = this->context().top().role == TraversalContext::ELEMENT_TYPE;
+    writer->Key(element ? "elementType" : "type");
+    switch (type.which()) {
+      /*[[[cog
+      types = ['void', 'bool', 'text', 'data', 'float32', 'float64']
+      types.extend('int%s' % size for size in [8, 16, 32, 64])
+      types.extend('uint%s' % size for size in [8, 16, 32, 64])
+      for type in types:
+        cog.outl('case schema::Type::%s:' % type.upper())
+        cog.outl('  writer->String("%s");' % type.lower())
+        cog.outl('  break;')
+      ]]]*/
+      case schema::Type::VOID:
+        writer->String("void");
+        break;
+      case schema::Type::BOOL:
+        writer->String("bool");
+        break;
+      case schema::Type::TEXT:
+        writer->String("text");
+        break;
+      case schema::Type::DATA:
+        writer->String("data");
+        break;
+      case schema::Type::FLOAT32:
+        writer->String("float32");
+        break;
+      case schema::Type::FLOAT64:
+        writer->String("float64");
+        break;
+      case schema::Type::INT8:
+        writer->String("int8");
+        break;
+      case schema::Type::INT16:
+        writer->String("int16");
+        break;
+      case schema::Type::INT32:
+        writer->String("int32");
+        break;
+      case schema::Type::INT64:
+        writer->String("int64");
+        break;
+      case schema::Type::UINT8:
+        writer->String("uint8");
+        break;
+      case schema::Type::UINT16:
+        writer->String("uint16");
+        break;
+      case schema::Type::UINT32:
+        writer->String("uint32");
+        break;
+      case schema::Type::UINT64:
+        writer->String("uint64");
+        break;
+      //[[[end]]]
+      case schema::Type::LIST:
+        // Closed in post_visit_type, after the traversal visits the element
+        // type under this key.
+        writer->StartObject();
+        writer->Key("which");
+        writer->String("list");
+        break;
+      case schema::Type::ENUM:
+        write_type_ref("enum", type.getEnum().getTypeId(),
+                       type.getEnum().getBrand(), schema);
+        break;
+      case schema::Type::STRUCT:
+        write_type_ref("struct", type.getStruct().getTypeId(),
+                       type.getStruct().getBrand(), schema);
+        break;
+      case schema::Type::INTERFACE:
+        write_type_ref("interface", type.getInterface().getTypeId(),
+                       type.getInterface().getBrand(), schema);
+        break;
+      case schema::Type::ANY_POINTER:
+        writer->StartObject();
+        writer->Key("which");
+        writer->String("anypointer");
+        writer->Key("unconstrained");
+        writer->Bool(type.getAnyPointer().isUnconstrained());
+        writer->EndObject();
+        break;
+    }
+    return false;
+  }
+
+  bool post_visit_type(const Schema&, const schema::Type::Reader& type) {
+    if (type.which() == schema::Type::LIST) {
+      writer->EndObject();
+    }
+    return false;
+  }
+
+  /*[[[cog
+  for name, _, param in scalar_types:
+    cog.outl('bool visit_%s_value(const Schema&, const Type&, const %s& value) {' % (name, param))
+    cog.outl('  start_value();')
+    cog.outl('  write_scalar(value);')
+    cog.outl('  return true;')
+    cog.outl('}')
+  ]]]*/
+  bool visit_bool_value(const Schema&, const Type&, const bool& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_int8_value(const Schema&, const Type&, const int8_t& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_int16_value(const Schema&, const Type&, const int16_t& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_int32_value(const Schema&, const Type&, const int32_t& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_int64_value(const Schema&, const Type&, const int64_t& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_uint8_value(const Schema&, const Type&, const uint8_t& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_uint16_value(const Schema&, const Type&, const uint16_t& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_uint32_value(const Schema&, const Type&, const uint32_t& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_uint64_value(const Schema&, const Type&, const uint64_t& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_float32_value(const Schema&, const Type&, const float& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_float64_value(const Schema&, const Type&, const double& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_text_value(const Schema&, const Type&, const Text::Reader& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  bool visit_data_value(const Schema&, const Type&, const Data::Reader& value) {
+    start_value();
+    write_scalar(value);
+    return true;
+  }
+  //[[[end]]]
+
+  // The whole list in one loop, without a hook call per element.
+  /*[[[cog
+  for name, _, param in primitive_types:
+    cog.outl('bool visit_%s_list(const Schema&, const Type&, const List<%s>::Reader& list) {' % (name, param))
+    cog.outl('  start_value();')
+    cog.outl('  writer->StartArray();')
+    cog.outl('  for (auto element : list) {')
+    cog.outl('    write_scalar(element);')
+    cog.outl('  }')
+    cog.outl('  writer->EndArray();')
+    cog.outl('  return true;')
+    cog.outl('}')
+  ]]]*/
+  bool visit_bool_list(const Schema&, const Type&, const List<bool>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_int8_list(const Schema&, const Type&, const List<int8_t>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_int16_list(const Schema&, const Type&, const List<int16_t>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_int32_list(const Schema&, const Type&, const List<int32_t>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_int64_list(const Schema&, const Type&, const List<int64_t>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_uint8_list(const Schema&, const Type&, const List<uint8_t>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_uint16_list(const Schema&, const Type&, const List<uint16_t>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_uint32_list(const Schema&, const Type&, const List<uint32_t>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_uint64_list(const Schema&, const Type&, const List<uint64_t>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_float32_list(const Schema&, const Type&, const List<float>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  bool visit_float64_list(const Schema&, const Type&, const List<double>::Reader& list) {
+    start_value();
+    writer->StartArray();
+    for (auto element : list) {
+      write_scalar(element);
+    }
+    writer->EndArray();
+    return true;
+  }
+  //[[[end]]]
+
+  // Scalars normally arrive through visit_<type>_value(); this covers the
+  // rest, and scalars of subclasses that decline some of them.
+  bool pre_visit_dynamic_value(const Schema& schema, const Type& type, const DynamicValue::Reader& value) {
+    start_value();
+    switch (type.which()) {
+      /*[[[cog
+      for name, as_type, _ in scalar_types:
+        cog.outl('case schema::Type::%s:' % name.upper())
+        cog.outl('  write_scalar(value.as<%s>());' % as_type)
+        cog.outl('  break;')
+      ]]]*/
+      case schema::Type::BOOL:
+        write_scalar(value.as<bool>());
+        break;
+      case schema::Type::INT8:
+        write_scalar(value.as<int8_t>());
+        break;
+      case schema::Type::INT16:
+        write_scalar(value.as<int16_t>());
+        break;
+      case schema::Type::INT32:
+        write_scalar(value.as<int32_t>());
+        break;
+      case schema::Type::INT64:
+        write_scalar(value.as<int64_t>());
+        break;
+      case schema::Type::UINT8:
+        write_scalar(value.as<uint8_t>());
+        break;
+      case schema::Type::UINT16:
+        write_scalar(value.as<uint16_t>());
+        break;
+      case schema::Type::UINT32:
+        write_scalar(value.as<uint32_t>());
+        break;
+      case schema::Type::UINT64:
+        write_scalar(value.as<uint64_t>());
+        break;
+      case schema::Type::FLOAT32:
+        write_scalar(value.as<float>());
+        break;
+      case schema::Type::FLOAT64:
+        write_scalar(value.as<double>());
+        break;
+      case schema::Type::TEXT:
+        write_scalar(value.as<Text>());
+        break;
+      case schema::Type::DATA:
+        write_scalar(value.as<Data>());
+        break;
+      //[[[end]]]
+      case schema::Type::VOID:
+        writer->String("void"); break;
+      case schema::Type::LIST: {
+        writer->StartArray();
+        break;
+      }
+      case schema::Type::STRUCT: {
+        writer->StartObject();
+        break;
+      }
+      case schema::Type::ENUM: {
+        auto enumValue = value.as<DynamicEnum>();
+        writer->StartObject();
+        writer->Key("value");
+        writer->Uint(enumValue.getRaw());
+        KJ_IF_MAYBE(enumerant, enumValue.getEnumerant()) {
+          writer->Key("enumerant");
+          writer->String(enumerant->getProto().getName().cStr());
+        }
+        writer->EndObject();
+        break;
+      }
+      case schema::Type::INTERFACE:
+      case schema::Type::ANY_POINTER:
+        writer->String("Cannot exist in a schema file.");
+        break;
+    }
+    return false;
+  }
+
+  bool post_visit_dynamic_value(const Schema& schema, const Type& type, const DynamicValue::Reader& value) {
+    switch (type.which()) {
+      case schema::Type::LIST: {
+        writer->EndArray();
+        break;
+      }
+      case schema::Type::STRUCT: {
+        writer->EndObject();
+        break;
+      }
+      default: break;
+    }
+    return false;
+  }
+
+  bool pre_visit_struct_fields(const StructSchema&) {
+    // A method's parameter and result structs, but not the groups in them.
+    const auto& frame = this->context().top();
+    switch (frame.role) {
+      case TraversalContext::PARAMS:
+      case TraversalContext::RESULTS:
+        writer->Key(frame.name.cStr());
+        break;
+      default:
+        writer->Key("fields");
+        break;
+    }
+    writer->StartArray();
+    return false;
+  }
+
+  bool post_visit_struct_fields(const StructSchema&) {
+    writer->EndArray();
+    return false;
+  }
+
+  bool pre_visit_struct_field(const StructSchema&, const StructSchema::Field& field) {
+    auto proto = field.getProto();
+    writer->StartObject();
+    writer->Key("name");
+    writer->String(proto.getName().cStr());
+    writer->Key("ordinal");
+    writer->StartObject();
+    auto ord = field.getProto().getOrdinal();
+    if (ord.isExplicit()) {
+      writer->Key("explicit");
+      writer->Int(ord.getExplicit());
+    } else {
+      writer->Key("implicit");
+      writer->Null();
+    }
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_struct_field_slot(const StructSchema&, const StructSchema::Field&, const schema::Field::Slot::Reader& slot) {
+    writer->Key("offset");
+    writer->Uint(slot.getOffset());
+    writer->Key("hadDefaultValue");
+    writer->Bool(slot.getHadExplicitDefault());
+    return false;
+  }
+
+  bool post_visit_struct_field(const StructSchema&, const StructSchema::Field&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_interface_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->Key("interface");
+    writer->StartObject();
+    return false;
+  }
+
+  bool post_visit_interface_decl(const Schema&, const schema::Node::NestedNode::Reader&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_methods(const InterfaceSchema&) {
+    writer->Key("methods");
+    writer->StartArray();
+    return false;
+  }
+
+  bool post_visit_methods(const InterfaceSchema&) {
+    writer->EndArray();
+    return false;
+  }
+
+  bool pre_visit_method(const InterfaceSchema&, const InterfaceSchema::Method& method) {
+    writer->StartObject();
+    writer->Key("name");
+    writer->String(method.getProto().getName().cStr());
+    writer->Key("ordinal");
+    writer->Int(method.getOrdinal());
+    return false;
+  }
+
+  bool post_visit_method(const InterfaceSchema&, const InterfaceSchema::Method&) {
+    writer->EndObject();
+    return false;
+  }
+
+  bool pre_visit_method_implicit_params(const InterfaceSchema&,
+      const InterfaceSchema::Method&,
+      const capnp::List<capnp::schema::Node::Parameter>::Reader& params) {
+    writer->Key("implicit_parameters");
+    writer->StartArray();
+    for (auto param : params) {
+      writer->String(param.getName().cStr());
+    }
+    writer->EndArray();
+    return false;
+  }
+
+  bool pre_visit_annotations(const Schema&) {
+    writer->Key("annotations");
+    writer->StartArray();
+    return false;
+  }
+
+  bool post_visit_annotations(const Schema&) {
+    writer->EndArray();
+    return false;
+  }
+
+  bool pre_visit_annotation(const schema::Annotation::Reader& annotation, const Schema&) {
+    writer->StartObject();
+    writer->Key("id");
+    writer->Uint64(annotation.getId());
+    writer->Key("name");
+    // The traversal already resolved the declaration to name the context.
+    writer->String(this->context().top().name.cStr());
+    return false;
+  }
+
+  bool post_visit_annotation(const schema::Annotation::Reader&, const Schema&) {
+    writer->EndObject();
+    return false;
+  }
+};
+
+template <class Base>
+constexpr const char CapnpcJsonGenerator<Base>::FILE_SUFFIX[];
+
+class CapnpcJson : public CapnpcJsonGenerator<BaseGenerator> {
+ public:
+  CapnpcJson(SchemaLoader &schemaLoader, const Options& options = Options())
+      : CapnpcJsonGenerator(schemaLoader, options) {
+  }
+};
+
+class StaticCapnpcJson
+    : public CapnpcJsonGenerator<StaticGenerator<StaticCapnpcJson>> {
+ public:
+  StaticCapnpcJson(SchemaLoader &schemaLoader,
+                   const Options& options = Options())
+      : CapnpcJsonGenerator(schemaLoader, options) {
+  }
+};